@@ -1,28 +1,91 @@
 #include "devices/block.h"
+#include <hash.h>
 #include <list.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <threads/synch.h>
 #include <filesys/filesys.h>
 #include <threads/interrupt.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 
-#define NUM_BLOCKS_IN_CACHE 64
+#define DEFAULT_CACHE_BLOCKS 64                 //cache size unless -cache=N says otherwise
+#define CACHE_SHARD_CNT 4                       //independently locked partitions of the cache
+#define CACHE_LOW_WATER_PAGES 32                //shrink the cache while the kernel pool has fewer free pages
+#define CACHE_HIGH_WATER_PAGES 64               //grow it back while the kernel pool has more
+#define CACHE_BATCH_SECTORS 16                  //most sectors the cache moves with one device request
+#define CACHE_RUNS_IN_FLIGHT 4                  //device requests read-ahead and write-behind keep going at once
 
+#define WRITE_BEHIND_PERIOD (TIMER_FREQ / 10)   //ticks between flusher passes
+#define DEFAULT_WRITE_BEHIND_AGE_MS 1000        //dirty blocks older than this are written back
+#define DEFAULT_WRITE_BEHIND_RATIO 25           //percent of the cache allowed dirty before everything is written back
+
+
+/* States of a cached_block. */
+enum cache_state {
+  CACHE_UNUSED,                       //holds no sector, on its shard's unused list
+  CACHE_READING,                      //being filled from disk, anybody else wanting the sector waits for io_done
+  CACHE_VALID,                        //holds its sector
+  CACHE_WRITING                       //old contents going to disk before eviction, still found under the old key
+};
 
 /* A single 512 byte block cached in memory. */
 struct cached_block {
   block_sector_t sector;              //sector represented by this cached block
   struct block *block;                //block device represented
-  uint8_t cache[BLOCK_SECTOR_SIZE];   //pointer to some location in memory for that block
+  uint8_t cache[BLOCK_SECTOR_SIZE];   //the cached contents of the sector
   bool dirty;                         //whether block is dirty or not
-  struct lock block_lock;             //protects buffer at loc_in_mem and dirty bit only. All else is protected by global lock.
-  struct list_elem elem;              //for use in block_cache
+  int64_t dirty_since;                //timer tick at which the block last went from clean to dirty
+  struct lock block_lock;             //protects cache[], the dirty bits and write_intent. Only taken while pinned
+  bool write_intent;                  //pinned by block_cache_get() with BLOCK_CACHE_WRITE
+  bool prefetched;                    //brought in by block_cache_prefetch() and not requested since
+
+  struct cache_shard *shard;          //shard owning this block. Everything below is protected by its lock
+  enum cache_state state;
+  int pin_cnt;                        //threads holding or waiting for block_lock. Only unpinned blocks are evicted
+  struct list_elem elem;              //for use in shard->blocks
+  struct list_elem policy_elem;       //for use in shard->unused or a replacement policy list
+  int queue;                          //which of its lists the replacement policy keeps this block on
+  struct hash_elem hash_elem;         //for use in shard->index, keyed on (block, sector)
+};
 
+/* One independently locked partition of the cache. A given sector always belongs to the same shard, so threads
+   working on sectors of different shards never wait on each other, and nobody holds a shard lock across disk I/O. */
+struct cache_shard {
+  struct lock lock;                   //protects everything in the shard except the blocks' contents
+  struct condition io_done;           //broadcast when a block of the shard leaves CACHE_READING or CACHE_WRITING
+  struct condition unpinned;          //signaled when a block of the shard drops to pin_cnt 0
+  struct hash index;                  //blocks holding a sector, i.e. in any state but CACHE_UNUSED
+  struct list blocks;                 //every block of the shard
+  struct list unused;                 //blocks in CACHE_UNUSED
+  struct list slabs;                  //pages holding the blocks, newest last
+  size_t slab_cnt;
+  size_t size;                        //number of blocks
+
+  /* Replacement policy state. */
+  struct list queues[2];              //lru keeps one list, 2q keeps A1in and Am
+  size_t queue_cnt[2];
+  struct list ghosts;                 //2q A1out, newest first
+  struct list free_ghosts;
+  size_t ghost_cnt;                   //ghosts allocated, on either list
+  struct hash ghost_index;
 };
 
+/* A page of contiguous cached_blocks, all owned by one shard. The cache grows and shrinks a slab at a time. */
+struct cache_slab {
+  struct list_elem elem;              //for use in shard->slabs
+  struct cached_block blocks[];       //fills the rest of the page
+};
+
+#define CACHE_SLAB_BLOCKS ((PGSIZE - sizeof(struct cache_slab)) / sizeof(struct cached_block))
+
 
 /* A block device. */
 struct block {
@@ -37,144 +100,1342 @@ struct block {
 
   unsigned long long read_cnt;        /* Number of sectors read. */
   unsigned long long write_cnt;       /* Number of sectors written. */
+
+  struct block_queue *queue;          /* Request queue, or null to call the driver directly. */
+
+  /* Request statistics, protected by turning interrupts off. */
+  struct block_stats stats;           /* Name and sector counts unused. */
+  block_sector_t next_sector;         /* Where the last dispatched transfer ended. */
 };
 
 
-struct lock global_cache_lock;
-struct list block_cache;
+static struct cache_shard shards[CACHE_SHARD_CNT];
+static size_t cache_max_blocks = DEFAULT_CACHE_BLOCKS;
+static size_t cache_blocks;           //blocks in all shards. Only changed by block_cache_init(), the flusher and teardown
 
-void
-block_cache_init(void) {
-  list_init(&block_cache);
-  lock_init(&global_cache_lock);
-  lock_acquire(&global_cache_lock);
-  int i = NUM_BLOCKS_IN_CACHE;
-  while (i --> 0) {
-    struct cached_block *new_block = malloc(sizeof(struct cached_block));
-    new_block->sector = 0;
-    new_block->block = NULL; //works also as a flag that states the block is not currently used when set to NULL
-    new_block->dirty = false;
-    lock_init(&new_block->block_lock);
-    list_push_front(&block_cache, &new_block->elem);
+static int dirty_cnt;                 //number of dirty cached_blocks, updated with interrupts off
+static struct cache_stats stats;      //updated with interrupts off, see stat_add()
+
+static int64_t write_behind_age = DEFAULT_WRITE_BEHIND_AGE_MS * TIMER_FREQ / 1000;
+static int write_behind_ratio = DEFAULT_WRITE_BEHIND_RATIO;
+static bool flusher_stop;             //asks cache_flusher() to exit
+static struct semaphore flusher_done; //up'd by cache_flusher() when it exits
+
+static void cache_flusher(void *aux);
+static void check_sector(struct block *, block_sector_t);
+
+static unsigned
+cache_key_hash(const struct block *block, block_sector_t sector) {
+  return hash_bytes(&block, sizeof block) ^ hash_int((int) sector);
+}
+
+static bool
+cache_key_less(const struct block *a_block, block_sector_t a_sector,
+               const struct block *b_block, block_sector_t b_sector) {
+  if (a_block != b_block) {
+    return a_block < b_block;
   }
-  lock_release(&global_cache_lock);
+  return a_sector < b_sector;
+}
+
+static unsigned
+cached_block_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct cached_block *cb = hash_entry(e, struct cached_block, hash_elem);
+  return cache_key_hash(cb->block, cb->sector);
 }
 
-/* returns true if we hold block-lock */
 static bool
-write_if_dirty(struct cached_block *bl) {
+cached_block_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED) {
+  const struct cached_block *a = hash_entry(a_, struct cached_block, hash_elem);
+  const struct cached_block *b = hash_entry(b_, struct cached_block, hash_elem);
+  return cache_key_less(a->block, a->sector, b->block, b->sector);
+}
+
+/* Returns the shard SECTOR of BLOCK belongs to */
+static struct cache_shard *
+shard_for(const struct block *block, block_sector_t sector) {
+  //the shard indexes pick buckets with the low bits of the same hash, so use the high ones here
+  return &shards[(cache_key_hash(block, sector) >> 24) % CACHE_SHARD_CNT];
+}
+
+/* needs to have shard lock. Returns the cached block holding SECTOR of BLOCK_DEVICE, or NULL on a miss */
+static struct cached_block *
+lookup_cached_block(struct cache_shard *shard, struct block *block_device, block_sector_t sector) {
+  struct cached_block key;
+  struct hash_elem *e;
+
+  ASSERT(lock_held_by_current_thread(&shard->lock));
+  key.block = block_device;
+  key.sector = sector;
+  e = hash_find(&shard->index, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct cached_block, hash_elem) : NULL;
+}
 
-  if (bl->block != NULL && bl->dirty == true) {
-    /* NOTE: We do not give up global lock
-     * This will still run since we only acquire the inside cache_lock when we no longer need global lock anymore
-     */
-    if (!lock_held_by_current_thread(&bl->block_lock)) {
-      lock_acquire(&bl->block_lock);
+/* Adds N to the statistics counter COUNTER */
+static void
+stat_add(unsigned long long *counter, unsigned long long n) {
+  enum intr_level old_level = intr_disable();
+  *counter += n;
+  intr_set_level(old_level);
+}
+
+/* lock_acquire() that counts the time spent blocked on LOCK in the statistics */
+static void
+timed_lock_acquire(struct lock *lock) {
+  int64_t start;
+
+  if (lock_try_acquire(lock)) {
+    return;
+  }
+  start = timer_ticks();
+  lock_acquire(lock);
+  stat_add(&stats.lock_waits, 1);
+  stat_add(&stats.lock_wait_ticks, timer_elapsed(start));
+}
+
+/* Request statistics.
+
+   Latency runs from block_submit() to block_request_complete() and is timed with the CPU's time-stamp counter. The
+   seek statistics compare each transfer handed to the driver, after any sorting and merging, with where the previous
+   one ended */
+
+/* Returns the histogram bucket for X, see block-stats.h */
+static int
+log2_bucket(uint64_t x, int bucket_cnt) {
+  int bucket = 0;
+  while (x > 1 && bucket < bucket_cnt - 1) {
+    x >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/* Counts R as in flight on BLOCK, where it is being submitted. A request already in flight elsewhere is being passed
+   on, as partitions do to their disk, and moves over with its original submission time */
+static void
+stats_submit(struct block *block, struct block_request *r) {
+  struct block_stats *s = &block->stats;
+  enum intr_level old_level = intr_disable();
+
+  if (r->timed_block != NULL) {
+    r->timed_block->stats.in_flight--;
+  } else {
+    r->submit_tsc = timer_tsc();
+  }
+  r->timed_block = block;
+  s->in_flight++;
+  if (s->in_flight > s->max_in_flight) {
+    s->max_in_flight = s->in_flight;
+  }
+  s->depth_sum += s->in_flight;
+  intr_set_level(old_level);
+}
+
+/* Records the latency of R, which is done. Must come before anything that may reuse R */
+static void
+stats_complete(struct block_request *r) {
+  struct block *block = r->timed_block;
+  enum intr_level old_level;
+  struct block_stats *s;
+  uint64_t us;
+
+  if (block == NULL) {
+    return; //not from block_submit(), e.g. a queue's merged request
+  }
+  s = &block->stats;
+  us = timer_tsc_to_us(timer_tsc() - r->submit_tsc);
+  old_level = intr_disable();
+  s->in_flight--;
+  s->requests[r->write]++;
+  s->latency_us[r->write] += us;
+  s->latency_hist[r->write][log2_bucket(us, BLOCK_LATENCY_BUCKETS)]++;
+  intr_set_level(old_level);
+  r->timed_block = NULL;
+}
+
+/* Records that the driver of BLOCK is being handed the CNT sectors starting at SECTOR */
+static void
+stats_dispatch(struct block *block, block_sector_t sector, size_t cnt) {
+  struct block_stats *s = &block->stats;
+  enum intr_level old_level = intr_disable();
+
+  if (s->dispatches++ > 0 && sector != block->next_sector) {
+    block_sector_t distance = sector > block->next_sector ? sector - block->next_sector : block->next_sector - sector;
+    s->seeks++;
+    s->seek_sectors += distance;
+    s->seek_hist[log2_bucket(distance, BLOCK_SEEK_BUCKETS)]++;
+  }
+  block->next_sector = sector + cnt;
+  intr_set_level(old_level);
+}
+
+/* Reads the CNT sectors starting at SECTOR of BLOCK, the Nth of them into BUFFERS[N], straight from the driver with a
+   single request if it supports that */
+static void
+driver_readv(struct block *block, block_sector_t sector, void *const buffers[], size_t cnt) {
+  size_t i;
+  stats_dispatch(block, sector, cnt);
+  if (block->ops->readv != NULL) {
+    block->ops->readv(block->aux, sector, buffers, cnt);
+  } else {
+    for (i = 0; i < cnt; i++) {
+      block->ops->read(block->aux, sector + i, buffers[i]);
     }
-    bl->block->ops->write(bl->block->aux, bl->sector, bl->cache);
-    bl->dirty = false;
   }
-  return lock_held_by_current_thread(&bl->block_lock);
 }
 
+/* Writes the CNT sectors starting at SECTOR of BLOCK, the Nth of them from BUFFERS[N], straight to the driver with a
+   single request if it supports that */
+static void
+driver_writev(struct block *block, block_sector_t sector, void *const buffers[], size_t cnt) {
+  size_t i;
+  stats_dispatch(block, sector, cnt);
+  if (block->ops->writev != NULL) {
+    block->ops->writev(block->aux, sector, buffers, cnt);
+  } else {
+    for (i = 0; i < cnt; i++) {
+      block->ops->write(block->aux, sector + i, buffers[i]);
+    }
+  }
+}
+
+
+/* Request queues.
+
+   A driver with a submit operation may put its devices behind a
+   block_queue, normally one per controller.  Requests for them
+   are queued, and whenever the controller is idle the queue hands
+   it the next one, both from block_submit() and from the
+   completion of the previous request, so the queue keeps the
+   controller busy from its interrupt handler without any thread
+   in between.  Requests go out in ascending (device, sector)
+   order from wherever the last one ended, wrapping around at the
+   end (C-SCAN), unless the oldest has waited past its deadline.
+   Queued requests for adjacent sectors in the same direction go
+   out as one.  Queue state is shared with interrupt handlers, so
+   it is protected by turning interrupts off. */
+#define QUEUE_READ_DEADLINE (TIMER_FREQ / 2)    //ticks a read may wait before it jumps ahead of the sweep
+#define QUEUE_WRITE_DEADLINE (5 * TIMER_FREQ)   //same for writes, which are mostly write-behind
+#define QUEUE_MAX_MERGE 128                     //most sectors merged into one request
+
+struct block_queue {
+  char name[16];
+  struct list sorted;                 //pending requests by (device, sector)
+  struct list fifo;                   //pending requests by arrival
+  struct block *head_block;           //where the last request left off
+  block_sector_t head_sector;
+
+  /* What the driver is working on. */
+  bool busy;                          //merged is with the driver
+  struct block_request merged;        //stands in for batch[] with the driver
+  struct block_request *batch[QUEUE_MAX_MERGE];
+  size_t batch_cnt;
+  void *buffers[QUEUE_MAX_MERGE];     //merged.buffers, when batch[] holds more than one request
+};
+
+static bool
+request_less(const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED) {
+  const struct block_request *a = list_entry(a_, struct block_request, sorted_elem);
+  const struct block_request *b = list_entry(b_, struct block_request, sorted_elem);
+  return cache_key_less(a->block, a->sector, b->block, b->sector);
+}
+
+/* Creates a request queue called NAME. Attach devices with block_set_queue() */
+struct block_queue *
+block_queue_create(const char *name) {
+  struct block_queue *q = malloc(sizeof *q);
+  if (q == NULL) {
+    PANIC("Failed to allocate block request queue");
+  }
+  strlcpy(q->name, name, sizeof q->name);
+  list_init(&q->sorted);
+  list_init(&q->fifo);
+  q->head_block = NULL;
+  q->head_sector = 0;
+  q->busy = false;
+  q->batch_cnt = 0;
+  return q;
+}
+
+/* Routes all further requests for BLOCK through Q */
 void
-flush_block_cache(bool free_cached_blocks) {
-  lock_acquire(&global_cache_lock);
-  struct list_elem *cur_elem = list_begin(&block_cache);
-  struct list_elem *end_elem = list_end(&block_cache);
-  struct cached_block *cur_block;
-  while (cur_elem != end_elem) {
-    //loop through cache and write to disk
-    cur_block = list_entry(cur_elem, struct cached_block, elem);
+block_set_queue(struct block *block, struct block_queue *q) {
+  ASSERT(block->ops->submit != NULL);
+  block->queue = q;
+}
 
-    bool holding_lock = write_if_dirty(cur_block);
-    if (holding_lock) {
-      lock_release(&cur_block->block_lock);
+/* Interrupts off, a request pending. Returns the request to start next */
+static struct block_request *
+queue_pick(struct block_queue *q) {
+  struct block_request *oldest = list_entry(list_front(&q->fifo), struct block_request, fifo_elem);
+  struct list_elem *e;
+
+  if (timer_ticks() >= oldest->deadline) {
+    return oldest;
+  }
+  for (e = list_begin(&q->sorted); e != list_end(&q->sorted); e = list_next(e)) {
+    struct block_request *r = list_entry(e, struct block_request, sorted_elem);
+    if (!cache_key_less(r->block, r->sector, q->head_block, q->head_sector)) {
+      return r;
     }
+  }
+  //nothing ahead of the head, start the next sweep
+  return list_entry(list_front(&q->sorted), struct block_request, sorted_elem);
+}
 
-    cur_elem = list_next(cur_elem);
-    if (free_cached_blocks) {
-      free(cur_block);
+static void queue_merged_done(struct block_request *merged);
+
+/* Interrupts off. Hands the driver the next request, merged with whatever continues it, unless it is busy or there
+   is nothing to do */
+static void
+queue_dispatch(struct block_queue *q) {
+  struct block_request *r, *first;
+  size_t sector_cnt = 0;
+  size_t i;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  if (q->busy || list_empty(&q->sorted)) {
+    return;
+  }
+
+  first = r = queue_pick(q);
+  q->batch_cnt = 0;
+  for (;;) {
+    struct list_elem *next = list_next(&r->sorted_elem);
+    struct block_request *prev = r;
+
+    list_remove(&r->sorted_elem);
+    list_remove(&r->fifo_elem);
+    q->batch[q->batch_cnt++] = r;
+    sector_cnt += r->cnt;
+
+    if (next == list_end(&q->sorted)) {
+      break;
+    }
+    r = list_entry(next, struct block_request, sorted_elem);
+    if (r->block != prev->block || r->write != prev->write || r->sector != prev->sector + prev->cnt
+        || sector_cnt + r->cnt > QUEUE_MAX_MERGE) {
+      break;
+    }
+  }
+
+  if (q->batch_cnt > 1) {
+    size_t n = 0;
+    for (i = 0; i < q->batch_cnt; i++) {
+      memcpy(q->buffers + n, q->batch[i]->buffers, q->batch[i]->cnt * sizeof *q->buffers);
+      n += q->batch[i]->cnt;
     }
   }
+  block_request_init(&q->merged, first->block, first->sector, q->batch_cnt > 1 ? q->buffers : first->buffers,
+                     sector_cnt, first->write);
+  q->merged.complete = queue_merged_done;
+  q->merged.aux = q;
+  q->head_block = first->block;
+  q->head_sector = first->sector + sector_cnt;
+  q->busy = true;
+  stats_dispatch(first->block, first->sector, sector_cnt);
+  first->block->ops->submit(first->block->aux, &q->merged);
+}
 
-  lock_release(&global_cache_lock);
+/* Completion of a queue's merged request: completes the requests it stood for and starts the next one */
+static void
+queue_merged_done(struct block_request *merged) {
+  struct block_queue *q = merged->aux;
+  enum intr_level old_level = intr_disable();
+  size_t i;
+
+  //still busy, so that requests submitted from completion callbacks only queue up
+  for (i = 0; i < q->batch_cnt; i++) {
+    block_request_complete(q->batch[i]);
+  }
+  q->busy = false;
+  queue_dispatch(q);
+  intr_set_level(old_level);
+}
+
+/* Queues R on Q, starting it right away if the driver is idle */
+static void
+queue_submit(struct block_queue *q, struct block_request *r) {
+  enum intr_level old_level;
+
+  r->deadline = timer_ticks() + (r->write ? QUEUE_WRITE_DEADLINE : QUEUE_READ_DEADLINE);
+  old_level = intr_disable();
+  list_insert_ordered(&q->sorted, &r->sorted_elem, request_less, NULL);
+  list_push_back(&q->fifo, &r->fifo_elem);
+  queue_dispatch(q);
+  intr_set_level(old_level);
 }
 
-/* Must have block-lock and global-lock before call. Will have block-lock (not global lock) on return  */
+/* Initializes R to transfer the CNT sectors starting at SECTOR of BLOCK, the Nth of them to or from BUFFERS[N], with
+   no completion callback */
 void
-evict_and_replace(struct cached_block *bl, struct block *new_block_device, block_sector_t new_sector) {
-  ASSERT(lock_held_by_current_thread(&bl->block_lock));
-  ASSERT(lock_held_by_current_thread(&global_cache_lock));
-  write_if_dirty(bl); //always true since we have the block_lock
+block_request_init(struct block_request *r, struct block *block, block_sector_t sector, void *const buffers[],
+                   size_t cnt, bool write) {
+  r->block = block;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffers = buffers;
+  r->write = write;
+  r->complete = NULL;
+  r->aux = NULL;
+  r->done = false;
+  sema_init(&r->done_sema, 0);
+  r->timed_block = NULL;
+}
+
+/* Starts R, see struct block_request. Does not wait for the device, unless its driver can only do blocking I/O */
+void
+block_submit(struct block_request *r) {
+  struct block *block = r->block;
+
+  ASSERT(r->cnt > 0);
+  check_sector(block, r->sector);
+  check_sector(block, r->sector + r->cnt - 1);
+  ASSERT(!r->write || block->type != BLOCK_FOREIGN);
+  r->done = false;
+  stats_submit(block, r);
+
+  if (block->queue != NULL) {
+    queue_submit(block->queue, r);
+  } else if (block->ops->submit != NULL) {
+    enum intr_level old_level = intr_disable();
+    stats_dispatch(block, r->sector, r->cnt);
+    block->ops->submit(block->aux, r);
+    intr_set_level(old_level);
+  } else {
+    if (r->write) {
+      driver_writev(block, r->sector, r->buffers, r->cnt);
+    } else {
+      driver_readv(block, r->sector, r->buffers, r->cnt);
+    }
+    block_request_complete(r);
+  }
+}
+
+/* Returns true if R, submitted without a completion callback, is done */
+bool
+block_poll(const struct block_request *r) {
+  return r->done;
+}
+
+/* Waits until R, submitted without a completion callback, is done */
+void
+block_wait(struct block_request *r) {
+  sema_down(&r->done_sema);
+}
+
+/* Called by drivers, and the queue, once R is done. May run in an interrupt handler */
+void
+block_request_complete(struct block_request *r) {
+  stats_complete(r);
+  r->done = true;
+  if (r->complete != NULL) {
+    r->complete(r); //the last use of R
+  } else {
+    sema_up(&r->done_sema);
+  }
+}
+
+/* Reads the CNT sectors starting at SECTOR of BLOCK, the Nth of them into BUFFERS[N], and waits for them */
+static void
+device_readv(struct block *block, block_sector_t sector, void *const buffers[], size_t cnt) {
+  struct block_request r;
+  block_request_init(&r, block, sector, buffers, cnt, false);
+  block_submit(&r);
+  block_wait(&r);
+}
+
+/* Writes the CNT sectors starting at SECTOR of BLOCK, the Nth of them from BUFFERS[N], and waits for them */
+static void
+device_writev(struct block *block, block_sector_t sector, void *const buffers[], size_t cnt) {
+  struct block_request r;
+  block_request_init(&r, block, sector, buffers, cnt, true);
+  block_submit(&r);
+  block_wait(&r);
+}
+
+/* Replacement policies.
+
+   A policy decides which in-use cached_block of a shard gives up
+   its sector when a miss finds no unused block.  Every hook is
+   called with the shard's lock held.  A block in CACHE_VALID or
+   CACHE_WRITING is on exactly one of the shard's policy lists
+   through policy_elem. */
+struct cache_policy {
+  const char *name;
+  void (*init) (struct cache_shard *);
+  void (*insert) (struct cache_shard *, struct cached_block *);   //CB was just filled with a new sector
+  void (*access) (struct cache_shard *, struct cached_block *);   //CB was hit
+  void (*remove) (struct cache_shard *, struct cached_block *);   //CB is about to lose its sector
+  struct cached_block *(*victim) (struct cache_shard *);          //an unpinned block to evict, or NULL
+};
+
+/* Scans LIST from the back for a block nobody has pinned. Returns NULL if there is none */
+static struct cached_block *
+unpinned_from_back(struct list *list) {
+  struct list_elem *e;
+  for (e = list_rbegin(list); e != list_rend(list); e = list_prev(e)) {
+    struct cached_block *cb = list_entry(e, struct cached_block, policy_elem);
+    if (cb->pin_cnt == 0) {
+      ASSERT(cb->state == CACHE_VALID);
+      return cb;
+    }
+  }
+  return NULL;
+}
+
+/* Plain LRU: a single list, most recently used at the front. */
+static void
+lru_init(struct cache_shard *shard) {
+  list_init(&shard->queues[0]);
+}
+
+static void
+lru_insert(struct cache_shard *shard, struct cached_block *cb) {
+  list_push_front(&shard->queues[0], &cb->policy_elem);
+}
 
-  bl->sector = new_sector;
-  bl->block = new_block_device;
-  bl->dirty = false; //not necessary since is already false
+static void
+lru_access(struct cache_shard *shard, struct cached_block *cb) {
+  list_remove(&cb->policy_elem);
+  list_push_front(&shard->queues[0], &cb->policy_elem);
+}
 
-  //we already have lock
-  bl->block->ops->read(bl->block->aux, new_sector, bl->cache);
+static void
+lru_remove(struct cache_shard *shard UNUSED, struct cached_block *cb) {
+  list_remove(&cb->policy_elem);
+}
 
-  //LRU move to front
-  list_remove(&bl->elem);
-  list_push_front(&block_cache, &bl->elem);
+static struct cached_block *
+lru_victim(struct cache_shard *shard) {
+  return unpinned_from_back(&shard->queues[0]);
+}
 
-  lock_release(&global_cache_lock);
+static const struct cache_policy lru_policy = {
+  "lru", lru_init, lru_insert, lru_access, lru_remove, lru_victim
+};
+
+/* 2Q (Johnson and Shasha, VLDB '94).
+
+   A sector seen for the first time goes into A1in, a FIFO that a
+   sequential scan flows through without disturbing anything else.
+   When it falls out of A1in its key is remembered in the A1out
+   ghost list.  A sector that is requested again while its key is
+   in A1out has proven it is reused (inodes, indirect blocks,
+   directories), so it goes into Am, a plain LRU list that is only
+   drawn on once A1in is down to its share of the cache. */
+#define TWOQ_KIN_PERCENT 25             //share of the cache A1in may hold before Am is touched
+#define TWOQ_KOUT_PERCENT 50            //ghost keys remembered, as a share of the cache size
+
+enum twoq_queue {
+  TWOQ_A1IN,
+  TWOQ_AM
+};
+
+/* A key remembered after its block left A1in. */
+struct twoq_ghost {
+  struct block *block;
+  block_sector_t sector;
+  struct list_elem elem;                //in shard->ghosts, or shard->free_ghosts
+  struct hash_elem hash_elem;           //in shard->ghost_index while in shard->ghosts
+};
+
+static unsigned
+twoq_ghost_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct twoq_ghost *g = hash_entry(e, struct twoq_ghost, hash_elem);
+  return cache_key_hash(g->block, g->sector);
+}
+
+static bool
+twoq_ghost_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED) {
+  const struct twoq_ghost *a = hash_entry(a_, struct twoq_ghost, hash_elem);
+  const struct twoq_ghost *b = hash_entry(b_, struct twoq_ghost, hash_elem);
+  return cache_key_less(a->block, a->sector, b->block, b->sector);
+}
+
+static void
+twoq_init(struct cache_shard *shard) {
+  list_init(&shard->queues[TWOQ_A1IN]);
+  list_init(&shard->queues[TWOQ_AM]);
+  shard->queue_cnt[TWOQ_A1IN] = 0;
+  shard->queue_cnt[TWOQ_AM] = 0;
+  list_init(&shard->ghosts);
+  list_init(&shard->free_ghosts);
+  shard->ghost_cnt = 0;
+  if (!hash_init(&shard->ghost_index, twoq_ghost_hash, twoq_ghost_less, NULL)) {
+    PANIC("Failed to allocate 2Q ghost index");
+  }
+}
+
+static void
+twoq_insert(struct cache_shard *shard, struct cached_block *cb) {
+  struct twoq_ghost key;
+  struct hash_elem *e;
+
+  key.block = cb->block;
+  key.sector = cb->sector;
+  e = hash_find(&shard->ghost_index, &key.hash_elem);
+  if (e != NULL) {
+    //reused since it left A1in, promote straight to Am
+    struct twoq_ghost *g = hash_entry(e, struct twoq_ghost, hash_elem);
+    hash_delete(&shard->ghost_index, &g->hash_elem);
+    list_remove(&g->elem);
+    list_push_back(&shard->free_ghosts, &g->elem);
+    cb->queue = TWOQ_AM;
+  } else {
+    cb->queue = TWOQ_A1IN;
+  }
+  list_push_front(&shard->queues[cb->queue], &cb->policy_elem);
+  shard->queue_cnt[cb->queue]++;
+}
+
+static void
+twoq_access(struct cache_shard *shard, struct cached_block *cb) {
+  //hits in A1in are correlated references and do not count as reuse
+  if (cb->queue == TWOQ_AM) {
+    list_remove(&cb->policy_elem);
+    list_push_front(&shard->queues[TWOQ_AM], &cb->policy_elem);
+  }
+}
+
+static void
+twoq_remove(struct cache_shard *shard, struct cached_block *cb) {
+  list_remove(&cb->policy_elem);
+  shard->queue_cnt[cb->queue]--;
+  if (cb->queue == TWOQ_A1IN) {
+    struct twoq_ghost *g;
+
+    //ghosts are allocated as needed, since the shard's size follows memory pressure
+    if (!list_empty(&shard->free_ghosts)) {
+      g = list_entry(list_pop_front(&shard->free_ghosts), struct twoq_ghost, elem);
+    } else if (shard->ghost_cnt < shard->size * TWOQ_KOUT_PERCENT / 100 && (g = malloc(sizeof *g)) != NULL) {
+      shard->ghost_cnt++;
+    } else if (!list_empty(&shard->ghosts)) {
+      //forget the oldest ghost
+      g = list_entry(list_pop_back(&shard->ghosts), struct twoq_ghost, elem);
+      hash_delete(&shard->ghost_index, &g->hash_elem);
+    } else {
+      return; //shard too small to remember anything
+    }
+    g->block = cb->block;
+    g->sector = cb->sector;
+    list_push_front(&shard->ghosts, &g->elem);
+    hash_insert(&shard->ghost_index, &g->hash_elem);
+  }
+}
 
+static struct cached_block *
+twoq_victim(struct cache_shard *shard) {
+  size_t kin = shard->size * TWOQ_KIN_PERCENT / 100;
+  bool from_a1in = shard->queue_cnt[TWOQ_A1IN] > kin || list_empty(&shard->queues[TWOQ_AM]);
+  struct cached_block *cb = unpinned_from_back(&shard->queues[from_a1in ? TWOQ_A1IN : TWOQ_AM]);
+  return cb != NULL ? cb : unpinned_from_back(&shard->queues[from_a1in ? TWOQ_AM : TWOQ_A1IN]);
+}
+
+static const struct cache_policy twoq_policy = {
+  "2q", twoq_init, twoq_insert, twoq_access, twoq_remove, twoq_victim
+};
+
+static const struct cache_policy *cache_policies[] = {&twoq_policy, &lru_policy};
+static const struct cache_policy *cache_policy = &twoq_policy;
+
+/* Selects the replacement policy called NAME. Must be called before block_cache_init(). Returns false if unknown */
+bool
+block_cache_set_policy(const char *name) {
+  size_t i;
+  for (i = 0; i < sizeof cache_policies / sizeof *cache_policies; i++) {
+    if (!strcmp(name, cache_policies[i]->name)) {
+      cache_policy = cache_policies[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Sets the buffer cache size to at most BLOCKS sectors, rounded up to whole slabs. Must be called before
+   block_cache_init() */
+void
+block_cache_set_size(size_t blocks) {
+  cache_max_blocks = blocks;
+}
+
+/* Sets the write-behind thresholds: the flusher writes back blocks dirty for AGE_MS milliseconds, and every dirty
+   block once more than RATIO percent of the cache is dirty. A negative value keeps the current setting */
+void
+block_cache_set_write_behind(int age_ms, int ratio) {
+  if (age_ms >= 0) {
+    write_behind_age = (int64_t) age_ms * TIMER_FREQ / 1000;
+  }
+  if (ratio >= 0) {
+    write_behind_ratio = ratio < 100 ? ratio : 100;
+  }
+}
+
+/* Needs shard lock, unless the cache is not running yet. Hands the blocks of the new page SLAB to SHARD as unused */
+static void
+add_slab(struct cache_shard *shard, struct cache_slab *slab) {
+  size_t i;
+
+  for (i = 0; i < CACHE_SLAB_BLOCKS; i++) {
+    struct cached_block *new_block = &slab->blocks[i];
+    new_block->sector = 0;
+    new_block->block = NULL;
+    new_block->dirty = false;
+    new_block->dirty_since = 0;
+    lock_init(&new_block->block_lock);
+    new_block->write_intent = false;
+    new_block->prefetched = false;
+    new_block->shard = shard;
+    new_block->state = CACHE_UNUSED;
+    new_block->pin_cnt = 0;
+    list_push_back(&shard->blocks, &new_block->elem);
+    list_push_back(&shard->unused, &new_block->policy_elem);
+  }
+  list_push_back(&shard->slabs, &slab->elem);
+  shard->slab_cnt++;
+  shard->size += CACHE_SLAB_BLOCKS;
+  cache_blocks += CACHE_SLAB_BLOCKS;
+}
+
+void
+block_cache_init(void) {
+  struct cache_shard *shard;
+  size_t i;
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    lock_init(&shard->lock);
+    cond_init(&shard->io_done);
+    cond_init(&shard->unpinned);
+    if (!hash_init(&shard->index, cached_block_hash, cached_block_less, NULL)) {
+      PANIC("Failed to allocate buffer cache index");
+    }
+    list_init(&shard->blocks);
+    list_init(&shard->unused);
+    list_init(&shard->slabs);
+    shard->slab_cnt = 0;
+    shard->size = 0;
+  }
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    cache_policy->init(shard);
+  }
+  //every shard needs at least one slab, the rest are dealt out round robin
+  cache_blocks = 0;
+  for (i = 0; i < CACHE_SHARD_CNT || cache_blocks < cache_max_blocks; i++) {
+    struct cache_slab *slab = palloc_get_page(0);
+    if (slab == NULL) {
+      if (i < CACHE_SHARD_CNT) {
+        PANIC("Failed to allocate buffer cache");
+      }
+      break; //the flusher grows the cache later, if memory frees up
+    }
+    add_slab(&shards[i % CACHE_SHARD_CNT], slab);
+  }
+  if (cache_max_blocks < cache_blocks) {
+    cache_max_blocks = cache_blocks;
+  }
+  dirty_cnt = 0;
+
+  flusher_stop = false;
+  sema_init(&flusher_done, 0);
+  thread_create("cache-flush", PRI_DEFAULT, cache_flusher, NULL);
+}
+
+/* Must have block-lock. Marks BL dirty, starting its write-behind clock if it was clean */
+static void
+mark_dirty(struct cached_block *bl) {
   ASSERT(lock_held_by_current_thread(&bl->block_lock));
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock));
+  if (!bl->dirty) {
+    enum intr_level old_level = intr_disable();
+    bl->dirty = true;
+    bl->dirty_since = timer_ticks();
+    dirty_cnt++;
+    intr_set_level(old_level);
+  }
+}
 
+/* Must have block-lock. Marks BL clean after its contents reached the disk */
+static void
+mark_clean(struct cached_block *bl) {
+  ASSERT(lock_held_by_current_thread(&bl->block_lock));
+  if (bl->dirty) {
+    enum intr_level old_level = intr_disable();
+    bl->dirty = false;
+    dirty_cnt--;
+    intr_set_level(old_level);
+  }
 }
-/* needs to have global lock before call, will have block-lock on return */
-struct cached_block *
-get_cached_block(struct block *block_device, block_sector_t sector) {
-  ASSERT(lock_held_by_current_thread(&global_cache_lock)); //Caller should have secured this for us already
-  struct list_elem *cur_elem;
-  struct list_elem *end_elem = list_end(&block_cache);
-  struct cached_block *cur_block = NULL;
-  for (cur_elem = list_begin(&block_cache); cur_elem != end_elem; cur_elem = list_next(cur_elem)) {
-    cur_block = list_entry(cur_elem, struct cached_block, elem);
-    if (cur_block -> block == block_device && cur_block->sector == sector) {
-      //is in cache!
 
-      //LRU move to front
-      list_remove(&cur_block->elem);
-      list_push_front(&block_cache, &cur_block->elem);
+/* Must have block-lock. Writes BL back to disk if it is dirty */
+static void
+write_if_dirty(struct cached_block *bl) {
+  ASSERT(lock_held_by_current_thread(&bl->block_lock));
+  if (bl->block != NULL && bl->dirty) {
+    void *buffer = bl->cache;
+    device_writev(bl->block, bl->sector, &buffer, 1);
+    mark_clean(bl);
+    stat_add(&stats.write_backs, 1);
+  }
+}
 
-      enum intr_level old_level = intr_disable();
-      lock_release(&global_cache_lock);
-      lock_acquire(&cur_block->block_lock);
-      intr_set_level(old_level);
+/* Needs shard lock, CB unpinned and dirty. Writes the victim CB back with the shard lock dropped. Meanwhile it is in
+   CACHE_WRITING, so anybody after its sector waits for io_done instead of reading stale data from disk */
+static void
+write_back_victim(struct cached_block *cb) {
+  struct cache_shard *shard = cb->shard;
+
+  ASSERT(lock_held_by_current_thread(&shard->lock));
+  ASSERT(cb->pin_cnt == 0 && cb->state == CACHE_VALID);
+  cb->state = CACHE_WRITING;
+  cb->pin_cnt++;
+  lock_acquire(&cb->block_lock); //nobody holds or waits for an unpinned block's lock
+  lock_release(&shard->lock);
+
+  write_if_dirty(cb);
 
+  lock_release(&cb->block_lock);
+  lock_acquire(&shard->lock);
+  cb->state = CACHE_VALID;
+  if (--cb->pin_cnt == 0) {
+    cond_signal(&shard->unpinned, &shard->lock); //as cache_release() does
+  }
+  cond_broadcast(&shard->io_done, &shard->lock);
+}
+
+/* Needs shard lock, CB clean and unpinned. Takes CB away from whatever sector it holds, gives it SECTOR of BLOCK, pins
+   it and takes its block-lock. The caller fills it and calls fill_done() */
+static void
+rekey_block(struct cached_block *cb, struct block *block, block_sector_t sector, bool prefetch) {
+  struct cache_shard *shard = cb->shard;
+
+  ASSERT(lock_held_by_current_thread(&shard->lock));
+  ASSERT(cb->pin_cnt == 0 && !cb->dirty);
+  if (cb->state == CACHE_VALID) {
+    cache_policy->remove(shard, cb);
+    hash_delete(&shard->index, &cb->hash_elem);
+    stat_add(&stats.evictions, 1);
+  } else {
+    list_remove(&cb->policy_elem); //off shard->unused
+  }
+  stat_add(prefetch ? &stats.read_aheads : &stats.misses, 1);
+  cb->block = block;
+  cb->sector = sector;
+  cb->prefetched = prefetch;
+  hash_insert(&shard->index, &cb->hash_elem);
+  cb->pin_cnt++;
+  lock_acquire(&cb->block_lock); //nobody holds or waits for an unpinned block's lock
+}
+
+/* Needs shard lock. Makes CB, filled after rekey_block(), visible to everybody waiting for its sector */
+static void
+fill_done(struct cached_block *cb) {
+  struct cache_shard *shard = cb->shard;
+
+  cb->state = CACHE_VALID;
+  cache_policy->insert(shard, cb);
+  cond_broadcast(&shard->io_done, &shard->lock);
+}
+
+/* Pins SECTOR of BLOCK in the cache and returns its cached_block with block-lock held. Release with cache_release().
+   FILL is false when the caller is about to overwrite the whole sector, so there is no point reading it.
+   PREFETCH is true for read-ahead, which counts as neither a hit nor a miss.
+   Holds the shard lock only while looking at shard state, never across disk I/O */
+static struct cached_block *
+cache_acquire(struct block *block, block_sector_t sector, bool fill, bool prefetch) {
+  struct cache_shard *shard = shard_for(block, sector);
+  struct cached_block *cb;
+
+  timed_lock_acquire(&shard->lock);
+  for (;;) {
+    cb = lookup_cached_block(shard, block, sector);
+    if (cb != NULL) {
+      if (cb->state == CACHE_VALID) {
+        //is in cache!
+        if (!prefetch) {
+          cache_policy->access(shard, cb);
+          stat_add(&stats.hits, 1);
+          if (cb->prefetched) {
+            cb->prefetched = false;
+            stat_add(&stats.read_ahead_hits, 1);
+          }
+        }
+        break;
+      }
+      //somebody is reading or writing back this very sector, wait for that I/O only
+      cond_wait(&shard->io_done, &shard->lock);
+      continue;
+    }
+
+    //EVICTION PROCESS
+    if (!list_empty(&shard->unused)) {
+      cb = list_entry(list_front(&shard->unused), struct cached_block, policy_elem);
+    } else {
+      cb = cache_policy->victim(shard);
+    }
+    if (cb == NULL) {
+      //every block in the shard is pinned
+      cond_wait(&shard->unpinned, &shard->lock);
+      continue;
+    }
+    if (cb->state == CACHE_VALID && cb->dirty) {
+      //dirty was set by a holder of the block-lock, but the block is unpinned so nobody holds it now
+      write_back_victim(cb);
+      continue; //the shard may have changed while the lock was dropped
+    }
+
+    rekey_block(cb, block, sector, prefetch);
+    if (fill) {
+      cb->state = CACHE_READING;
+      lock_release(&shard->lock);
+      void *buffer = cb->cache;
+      device_readv(block, sector, &buffer, 1);
+      lock_acquire(&shard->lock);
+    }
+    fill_done(cb);
+    lock_release(&shard->lock);
+    return cb;
+  }
+  cb->pin_cnt++;
+  lock_release(&shard->lock);
+  timed_lock_acquire(&cb->block_lock);
+  ASSERT(cb->block == block && cb->sector == sector);
+  return cb;
+}
+
+/* Releases CB's block-lock and unpins it */
+static void
+cache_release(struct cached_block *cb) {
+  struct cache_shard *shard = cb->shard;
+
+  lock_release(&cb->block_lock);
+  lock_acquire(&shard->lock);
+  if (--cb->pin_cnt == 0) {
+    cond_signal(&shard->unpinned, &shard->lock);
+  }
+  lock_release(&shard->lock);
+}
+
+/* Pins the CACHE_VALID block holding SECTOR of BLOCK if it is dirty, for writing back, and returns it with block-lock
+   held. Returns NULL otherwise, if the caller holds the block-lock itself, or if WAIT is false and somebody else
+   holds it */
+static struct cached_block *
+cache_acquire_dirty(struct block *block, block_sector_t sector, bool wait) {
+  struct cache_shard *shard = shard_for(block, sector);
+  struct cached_block *cb;
+
+  lock_acquire(&shard->lock);
+  cb = lookup_cached_block(shard, block, sector);
+  //a block the caller itself holds is skipped: lock_try_acquire() and lock_acquire() both assert it isn't held
+  if (cb == NULL || cb->state != CACHE_VALID || !cb->dirty || lock_held_by_current_thread(&cb->block_lock)
+      || (!wait && !lock_try_acquire(&cb->block_lock))) {
+    lock_release(&shard->lock);
+    return NULL;
+  }
+  cb->pin_cnt++;
+  lock_release(&shard->lock);
+  if (wait) {
+    lock_acquire(&cb->block_lock);
+  }
+  return cb;
+}
+
+/* Pins the block holding SECTOR of BLOCK, after any I/O on it finishes, and returns it with block-lock held. Returns
+   NULL if the sector is not cached */
+static struct cached_block *
+cache_acquire_cached(struct block *block, block_sector_t sector) {
+  struct cache_shard *shard = shard_for(block, sector);
+  struct cached_block *cb;
+
+  lock_acquire(&shard->lock);
+  for (;;) {
+    cb = lookup_cached_block(shard, block, sector);
+    if (cb == NULL || cb->state == CACHE_VALID) {
       break;
     }
+    cond_wait(&shard->io_done, &shard->lock);
   }
-  if (cur_block -> block != block_device || cur_block->sector != sector) { //no worries about NULL pointer since that would mean cache did not exist
-    //EVICTION PROCESS
-    bool evicted = false;
-    //why tf is list_front and list_begin the exact same thing. whatever
-    for (cur_elem = list_back(&block_cache); cur_elem != list_head(&block_cache); cur_elem = list_prev(cur_elem)) {
-      //reverse look for unpinned blocks
-      cur_block = list_entry(cur_elem, struct cached_block, elem);
-      bool unpinned = lock_try_acquire(&cur_block->block_lock);
-      if (unpinned) { //WE EVICT THIS BLOCK!
-        evict_and_replace(cur_block, block_device, sector);
-        evicted = true;
+  if (cb != NULL) {
+    cb->pin_cnt++;
+  }
+  lock_release(&shard->lock);
+  if (cb != NULL) {
+    lock_acquire(&cb->block_lock);
+    ASSERT(cb->block == block && cb->sector == sector);
+  }
+  return cb;
+}
+
+/* Claims a block for SECTOR of BLOCK for read-ahead, without waiting for anything. Returns it pinned, in
+   CACHE_READING, with block-lock held; add it to a cache_run and start_run() it. Returns NULL and sets *CACHED if
+   the sector is cached or on its way already, or NULL alone if its shard has no clean unpinned block right now */
+static struct cached_block *
+cache_claim(struct block *block, block_sector_t sector, bool *cached) {
+  struct cache_shard *shard = shard_for(block, sector);
+  struct cached_block *cb = NULL;
+
+  lock_acquire(&shard->lock);
+  *cached = lookup_cached_block(shard, block, sector) != NULL;
+  if (!*cached) {
+    if (!list_empty(&shard->unused)) {
+      cb = list_entry(list_front(&shard->unused), struct cached_block, policy_elem);
+    } else {
+      cb = cache_policy->victim(shard);
+    }
+    if (cb != NULL && cb->state == CACHE_VALID && cb->dirty) {
+      cb = NULL; //writing it back is not worth it for read-ahead
+    }
+    if (cb != NULL) {
+      rekey_block(cb, block, sector, true);
+      cb->state = CACHE_READING;
+    }
+  }
+  lock_release(&shard->lock);
+  return cb;
+}
+
+/* Pinned blocks, with their block-locks held, that hold consecutive sectors of one device and move with one device
+   request. Read-ahead and write-behind submit several runs before waiting for any of them, so that the device
+   always has the next request queued */
+struct cache_run {
+  struct cached_block *blocks[CACHE_BATCH_SECTORS];
+  void *buffers[CACHE_BATCH_SECTORS];
+  size_t cnt;
+  struct block_request request;
+};
+
+/* Submits RUN to be read or, if WRITE, written, without waiting for it */
+static void
+start_run(struct cache_run *run, bool write) {
+  size_t i;
+
+  for (i = 0; i < run->cnt; i++) {
+    run->buffers[i] = run->blocks[i]->cache;
+  }
+  block_request_init(&run->request, run->blocks[0]->block, run->blocks[0]->sector, run->buffers, run->cnt, write);
+  block_submit(&run->request);
+}
+
+/* Waits for the CNT runs in RUNS, started with start_run(), in order, and releases their blocks as each one is done.
+   Blocks that were read become valid; blocks that were written become clean. This is done here rather than in a
+   completion callback because it needs the shard locks */
+static void
+finish_runs(struct cache_run runs[], size_t cnt) {
+  size_t r, i;
+
+  for (r = 0; r < cnt; r++) {
+    struct cache_run *run = &runs[r];
+    block_wait(&run->request);
+    for (i = 0; i < run->cnt; i++) {
+      struct cached_block *cb = run->blocks[i];
+      if (run->request.write) {
+        mark_clean(cb);
+      } else {
+        lock_acquire(&cb->shard->lock);
+        fill_done(cb);
+        lock_release(&cb->shard->lock);
+      }
+      cache_release(cb);
+    }
+    if (run->request.write) {
+      stat_add(&stats.write_backs, run->cnt);
+    }
+  }
+}
+
+/* The key of a sector picked for write-behind */
+struct cache_key {
+  struct block *block;
+  block_sector_t sector;
+};
+
+/* qsort() order for write-behind: by device, then by sector, so the disk sees an ascending sweep */
+static int
+compare_by_sector(const void *a_, const void *b_) {
+  const struct cache_key *a = a_;
+  const struct cache_key *b = b_;
+  if (a->block != b->block) {
+    return a->block < b->block ? -1 : 1;
+  }
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* One write-behind pass. Picks the dirty blocks that are old enough (or all of them, when too much of the cache is
+   dirty) shard by shard, then writes them back in sector order, CACHE_RUNS_IN_FLIGHT runs at a time */
+static void
+write_behind(void) {
+  struct cache_key *victims;
+  struct cache_run *runs;
+  size_t run_cnt = 0;
+  struct cache_shard *shard;
+  struct list_elem *e;
+  int64_t now = timer_ticks();
+  bool over_ratio = dirty_cnt * 100 > write_behind_ratio * (int) cache_blocks;
+  size_t victim_cnt = 0;
+  size_t i;
+
+  victims = malloc(cache_blocks * sizeof *victims);
+  runs = malloc(CACHE_RUNS_IN_FLIGHT * sizeof *runs);
+  if (victims == NULL || runs == NULL) {
+    free(victims);
+    free(runs);
+    return;
+  }
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    lock_acquire(&shard->lock);
+    for (e = list_begin(&shard->blocks); e != list_end(&shard->blocks); e = list_next(e)) {
+      //dirty is only peeked at here, cache_acquire_dirty() looks again
+      struct cached_block *cb = list_entry(e, struct cached_block, elem);
+      if (cb->state == CACHE_VALID && cb->dirty && (over_ratio || now - cb->dirty_since >= write_behind_age)) {
+        victims[victim_cnt].block = cb->block;
+        victims[victim_cnt].sector = cb->sector;
+        victim_cnt++;
+      }
+    }
+    lock_release(&shard->lock);
+  }
+
+  qsort(victims, victim_cnt, sizeof *victims, compare_by_sector);
+  i = 0;
+  while (i < victim_cnt) {
+    struct cache_run *run = &runs[run_cnt];
+    //while runs are in flight we hold their blocks, so do not wait for another one, as its holder may be waiting for
+    //ours; finish them first instead
+    struct cached_block *cb = cache_acquire_dirty(victims[i].block, victims[i].sector, run_cnt == 0);
+    if (cb == NULL && run_cnt > 0) {
+      finish_runs(runs, run_cnt);
+      run_cnt = 0;
+      run = &runs[0];
+      cb = cache_acquire_dirty(victims[i].block, victims[i].sector, true);
+    }
+
+    i++;
+    if (cb == NULL) {
+      continue;
+    }
+    if (!cb->dirty) {
+      cache_release(cb); //written back while we waited for it
+      continue;
+    }
+    run->cnt = 0;
+    run->blocks[run->cnt++] = cb;
+    //extend the run with the following sectors, never waiting, for the same reason
+    while (run->cnt < CACHE_BATCH_SECTORS && i < victim_cnt && victims[i].block == cb->block
+           && victims[i].sector == cb->sector + run->cnt) {
+      struct cached_block *next = cache_acquire_dirty(victims[i].block, victims[i].sector, false);
+      if (next == NULL) {
         break;
       }
+      run->blocks[run->cnt++] = next;
+      i++;
+    }
+    start_run(run, true);
+    if (++run_cnt == CACHE_RUNS_IN_FLIGHT) {
+      finish_runs(runs, run_cnt);
+      run_cnt = 0;
+    }
+  }
+  finish_runs(runs, run_cnt);
+  free(runs);
+  free(victims);
+}
+
+/* Copies the cache statistics into OUT */
+void
+block_cache_get_stats(struct cache_stats *out) {
+  enum intr_level old_level = intr_disable();
+  *out = stats;
+  out->blocks = cache_blocks;
+  out->dirty = dirty_cnt;
+  intr_set_level(old_level);
+}
+
+/* Writes back and drops every cached sector nobody is using, then zeroes the statistics, so that what follows runs
+   against a cold cache */
+void
+block_cache_reset(void) {
+  struct cache_shard *shard;
+  enum intr_level old_level;
+
+  flush_block_cache(false);
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    struct list_elem *e;
+
+    lock_acquire(&shard->lock);
+    for (e = list_begin(&shard->blocks); e != list_end(&shard->blocks); e = list_next(e)) {
+      struct cached_block *cb = list_entry(e, struct cached_block, elem);
+      //dirty is only set under a block-lock, which nobody holds on an unpinned block
+      if (cb->state == CACHE_VALID && cb->pin_cnt == 0 && !cb->dirty) {
+        cache_policy->remove(shard, cb);
+        hash_delete(&shard->index, &cb->hash_elem);
+        cb->state = CACHE_UNUSED;
+        cb->block = NULL;
+        cb->prefetched = false;
+        list_push_back(&shard->unused, &cb->policy_elem);
+      }
     }
-    if (!evicted) {
-      cur_block = list_entry(list_back(&block_cache), struct cached_block, elem);
-      lock_acquire(&cur_block->block_lock);
-      evict_and_replace(cur_block, block_device, sector);
+    lock_release(&shard->lock);
+  }
+
+  old_level = intr_disable();
+  memset(&stats, 0, sizeof stats);
+  intr_set_level(old_level);
+}
+
+/* Adds a slab to the smallest shard. Returns false if the kernel pool is out of pages */
+static bool
+cache_grow(void) {
+  struct cache_shard *shard, *smallest = shards;
+  struct cache_slab *slab = palloc_get_page(0);
+
+  if (slab == NULL) {
+    return false;
+  }
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    if (shard->slab_cnt < smallest->slab_cnt) {
+      smallest = shard;
     }
   }
-  //ONCE HERE, OUR SECTOR IS CUR_BLOCK SECTOR, REGARDLESS OF WHICH OF 3 WAYS WE GOT HERE
-  ASSERT(cur_block->sector == sector);
-  ASSERT(lock_held_by_current_thread(&cur_block->block_lock));
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock));
-  return cur_block;
+  lock_acquire(&smallest->lock);
+  add_slab(smallest, slab);
+  lock_release(&smallest->lock);
+  return true;
+}
 
+/* Gives the newest slab of the largest shard back to the kernel pool, writing its dirty blocks back first. Returns
+   false if no shard has a slab to spare, or the slab still has a block in use */
+static bool
+cache_shrink(void) {
+  struct cache_shard *shard, *largest = shards;
+  struct cache_slab *slab;
+  int passes = 0;
+  size_t i;
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    if (shard->slab_cnt > largest->slab_cnt) {
+      largest = shard;
+    }
+  }
+  shard = largest;
+  if (shard->slab_cnt <= 1) {
+    return false;
+  }
+
+  lock_acquire(&shard->lock);
+  slab = list_entry(list_back(&shard->slabs), struct cache_slab, elem);
+  i = 0;
+  while (i < CACHE_SLAB_BLOCKS) {
+    struct cached_block *cb = &slab->blocks[i];
+    if (cb->pin_cnt > 0) {
+      //in use or in flight, try again next pass
+      lock_release(&shard->lock);
+      return false;
+    }
+    if (cb->state == CACHE_VALID && cb->dirty) {
+      if (++passes > 2 * (int) CACHE_SLAB_BLOCKS) {
+        lock_release(&shard->lock);
+        return false;
+      }
+      write_back_victim(cb);
+      i = 0; //the lock was dropped, look at the whole slab again
+      continue;
+    }
+    i++;
+  }
+
+  //every block of the slab is clean and unpinned
+  for (i = 0; i < CACHE_SLAB_BLOCKS; i++) {
+    struct cached_block *cb = &slab->blocks[i];
+    if (cb->state == CACHE_VALID) {
+      cache_policy->remove(shard, cb);
+      hash_delete(&shard->index, &cb->hash_elem);
+    } else {
+      list_remove(&cb->policy_elem); //off shard->unused
+    }
+    list_remove(&cb->elem);
+  }
+  list_remove(&slab->elem);
+  shard->slab_cnt--;
+  shard->size -= CACHE_SLAB_BLOCKS;
+  cache_blocks -= CACHE_SLAB_BLOCKS;
+  lock_release(&shard->lock);
+
+  palloc_free_page(slab);
+  return true;
+}
+
+/* Grows or shrinks the cache by a slab to follow the number of free pages in the kernel pool. The cache never grows
+   past the size set with block_cache_set_size() nor shrinks below one slab per shard */
+static void
+cache_resize(void) {
+  size_t free_pages = palloc_free_cnt(0);
+
+  if (free_pages < CACHE_LOW_WATER_PAGES) {
+    cache_shrink();
+  } else if (free_pages > CACHE_HIGH_WATER_PAGES && cache_blocks + CACHE_SLAB_BLOCKS <= cache_max_blocks) {
+    cache_grow();
+  }
+}
+
+/* Write-behind thread, started by block_cache_init(). Also resizes the cache */
+static void
+cache_flusher(void *aux UNUSED) {
+  while (!flusher_stop) {
+    timer_sleep(WRITE_BEHIND_PERIOD);
+    if (!flusher_stop) {
+      write_behind();
+      cache_resize();
+    }
+  }
+  sema_up(&flusher_done);
+}
+
+void
+flush_block_cache(bool free_cached_blocks) {
+  struct cache_shard *shard;
+
+  if (free_cached_blocks) {
+    //the flusher must not touch blocks we are about to free
+    flusher_stop = true;
+    sema_down(&flusher_done);
+  }
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++) {
+    struct list_elem *e;
+
+    lock_acquire(&shard->lock);
+    for (e = list_begin(&shard->blocks); e != list_end(&shard->blocks); e = list_next(e)) {
+      //loop through cache and write to disk
+      struct cached_block *cb = list_entry(e, struct cached_block, elem);
+      if (cb->state == CACHE_VALID && cb->dirty) {
+        //stays pinned until the shard lock is back, so the flusher cannot shrink it out from under E
+        cb->pin_cnt++;
+        lock_release(&shard->lock);
+        lock_acquire(&cb->block_lock);
+        write_if_dirty(cb);
+        lock_release(&cb->block_lock);
+        lock_acquire(&shard->lock);
+        if (--cb->pin_cnt == 0) {
+          cond_signal(&shard->unpinned, &shard->lock);
+        }
+      }
+    }
+    if (free_cached_blocks) {
+      while (!list_empty(&shard->slabs)) {
+        palloc_free_page(list_entry(list_pop_front(&shard->slabs), struct cache_slab, elem));
+      }
+      //nothing may point into the freed pages any more
+      hash_clear(&shard->index, NULL);
+      list_init(&shard->blocks);
+      list_init(&shard->unused);
+      list_init(&shard->queues[0]);
+      list_init(&shard->queues[1]);
+      shard->queue_cnt[0] = shard->queue_cnt[1] = 0;
+      cache_blocks -= shard->size;
+      shard->slab_cnt = 0;
+      shard->size = 0;
+    }
+    lock_release(&shard->lock);
+  }
 }
 
 
@@ -274,7 +1535,7 @@ void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
+  device_readv (block, sector, &buffer, 1);
   block->read_cnt++;
 }
 
@@ -288,34 +1549,131 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
+  device_writev (block, sector, (void *const *) &buffer, 1);
   block->write_cnt++;
 }
 
+/* Reads the CNT sectors starting at SECTOR from BLOCK, the Nth of
+   them into BUFFERS[N], with as few device requests as the driver
+   allows. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             void *const buffers[], size_t cnt)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  device_readv (block, sector, buffers, cnt);
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK, the Nth of
+   them from BUFFERS[N], with as few device requests as the driver
+   allows. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              void *const buffers[], size_t cnt)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  device_writev (block, sector, buffers, cnt);
+  block->write_cnt += cnt;
+}
+
 
 void block_cache_read(struct block *block, block_sector_t sector, void *buffer) {
   check_sector(block, sector);
-  lock_acquire(&global_cache_lock);
-  struct cached_block *cb = get_cached_block(block, sector);
+  struct cached_block *cb = cache_acquire(block, sector, true, false);
   memcpy(buffer, cb->cache, BLOCK_SECTOR_SIZE);
-  lock_release(&cb->block_lock);
+  cache_release(cb);
   block->read_cnt++;
+}
+
+/* Brings SECTOR of BLOCK into the cache without copying it anywhere, for read-ahead. Does nothing if it is already
+   cached, and does not count as a use of that sector for the replacement policy */
+void
+block_cache_prefetch(struct block *block, block_sector_t sector) {
+  struct cache_shard *shard;
+  bool cached;
 
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock))
+  check_sector(block, sector);
+  shard = shard_for(block, sector);
+  lock_acquire(&shard->lock);
+  cached = lookup_cached_block(shard, block, sector) != NULL;
+  lock_release(&shard->lock);
+  if (cached) {
+    return;
+  }
+  cache_release(cache_acquire(block, sector, true, true));
+}
+
+/* Brings the CNT sectors starting at SECTOR of BLOCK into the cache like block_cache_prefetch(), reading each run of
+   them that is not cached yet with as few device requests as possible, CACHE_RUNS_IN_FLIGHT of them at a time */
+void
+block_cache_prefetch_range(struct block *block, block_sector_t sector, block_sector_t cnt) {
+  struct cache_run *runs, *run;
+  size_t run_cnt = 0;
+  block_sector_t i;
+
+  if (cnt == 0) {
+    return;
+  }
+  check_sector(block, sector);
+  check_sector(block, sector + cnt - 1);
+  runs = malloc(CACHE_RUNS_IN_FLIGHT * sizeof *runs);
+  if (runs == NULL) {
+    return; //read-ahead is only a hint
+  }
+  run = &runs[0];
+  run->cnt = 0;
+  for (i = 0; i < cnt; i++) {
+    bool cached;
+    struct cached_block *cb = cache_claim(block, sector + i, &cached);
+    if (cb != NULL) {
+      run->blocks[run->cnt++] = cb;
+      if (run->cnt < CACHE_BATCH_SECTORS) {
+        continue;
+      }
+    }
+    if (run->cnt > 0) {
+      start_run(run, false);
+      if (++run_cnt == CACHE_RUNS_IN_FLIGHT) {
+        finish_runs(runs, run_cnt);
+        run_cnt = 0;
+      }
+      run = &runs[run_cnt];
+      run->cnt = 0;
+    }
+    if (cb == NULL && !cached) {
+      //no block to spare without waiting, which must not happen while holding runs
+      finish_runs(runs, run_cnt);
+      run_cnt = 0;
+      run = &runs[0];
+      run->cnt = 0;
+      block_cache_prefetch(block, sector + i);
+    }
+  }
+  if (run->cnt > 0) {
+    start_run(run, false);
+    run_cnt++;
+  }
+  finish_runs(runs, run_cnt);
+  free(runs);
 }
 
 void
 block_cache_write(struct block *block, block_sector_t sector, const void *buffer) {
 
   check_sector(block, sector);
-  lock_acquire(&global_cache_lock);
-  struct cached_block *cb = get_cached_block(block, sector);
+  struct cached_block *cb = cache_acquire(block, sector, false, false);
   memcpy(cb->cache, buffer, BLOCK_SECTOR_SIZE);
-  cb->dirty = true;
-  lock_release(&cb->block_lock);
-  block->read_cnt++;
-
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock))
+  mark_dirty(cb);
+  cache_release(cb);
+  block->write_cnt++;
 }
 
 
@@ -326,13 +1684,10 @@ block_cache_read_offset(struct block *block, block_sector_t sector, void *buffer
   ASSERT(offset + num_bytes <= BLOCK_SECTOR_SIZE)
 
   check_sector(block, sector);
-  lock_acquire(&global_cache_lock);
-  struct cached_block *cb = get_cached_block(block, sector);
+  struct cached_block *cb = cache_acquire(block, sector, true, false);
   memcpy(buffer, cb->cache + offset, num_bytes);
-  lock_release(&cb->block_lock);
+  cache_release(cb);
   block->read_cnt++;
-
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock))
 }
 
 
@@ -344,14 +1699,84 @@ block_cache_write_offset(struct block *block, block_sector_t sector, const void
   ASSERT(offset + num_bytes <= BLOCK_SECTOR_SIZE)
 
   check_sector(block, sector);
-  lock_acquire(&global_cache_lock);
-  struct cached_block *cb = get_cached_block(block, sector);
+  //a whole sector is overwritten, so don't read it first
+  bool fill = offset != 0 || num_bytes != BLOCK_SECTOR_SIZE;
+  struct cached_block *cb = cache_acquire(block, sector, fill, false);
   memcpy(cb->cache + offset, buffer, num_bytes);
-  cb->dirty = true;
-  lock_release(&cb->block_lock);
-  block->read_cnt++;
+  mark_dirty(cb);
+  cache_release(cb);
+  block->write_cnt++;
+}
 
-  ASSERT(!lock_held_by_current_thread(&global_cache_lock))
+/* For direct I/O, which bypasses the cache: call before reading CNT sectors of BLOCK from SECTOR straight from the
+   device, so that it holds what the dirty cached ones hold */
+void
+block_cache_write_back_range(struct block *block, block_sector_t sector, block_sector_t cnt) {
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++) {
+    struct cached_block *cb = cache_acquire_dirty(block, sector + i, true);
+    if (cb != NULL) {
+      write_if_dirty(cb);
+      cache_release(cb);
+    }
+  }
+}
+
+/* For direct I/O, which bypasses the cache: call after writing CNT sectors of BLOCK from SECTOR straight to the
+   device, the Nth of them from BUFFERS[N], so that cached copies of them don't go stale. A copy is left dirty, since
+   write-behind may have put its old contents over the direct write in the meantime */
+void
+block_cache_update_range(struct block *block, block_sector_t sector, void *const buffers[], block_sector_t cnt) {
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++) {
+    struct cached_block *cb = cache_acquire_cached(block, sector + i);
+    if (cb != NULL) {
+      memcpy(cb->cache, buffers[i], BLOCK_SECTOR_SIZE);
+      mark_dirty(cb);
+      cache_release(cb);
+    }
+  }
+}
+
+/* Returns the cached_block whose cache[] DATA points to */
+static struct cached_block *
+data_to_cached_block(void *data) {
+  return (struct cached_block *) ((uint8_t *) data - offsetof(struct cached_block, cache));
+}
+
+/* Pins SECTOR of BLOCK in the cache and returns a pointer to its BLOCK_SECTOR_SIZE bytes, so metadata can be read
+   or updated in place without a copy. With BLOCK_CACHE_WRITE the sector is marked dirty when it is put back.
+   Nobody else can use the sector until block_cache_put(), so do not get the same sector twice */
+void *
+block_cache_get(struct block *block, block_sector_t sector, enum block_cache_intent intent) {
+  check_sector(block, sector);
+  struct cached_block *cb = cache_acquire(block, sector, true, false);
+  cb->write_intent = intent == BLOCK_CACHE_WRITE;
+  if (cb->write_intent) {
+    block->write_cnt++;
+  } else {
+    block->read_cnt++;
+  }
+  return cb->cache;
+}
+
+/* Marks the sector pinned at DATA as modified, for callers that got it with BLOCK_CACHE_READ */
+void
+block_cache_mark_dirty(void *data) {
+  mark_dirty(data_to_cached_block(data));
+}
+
+/* Unpins the sector at DATA, returned by block_cache_get() */
+void
+block_cache_put(void *data) {
+  struct cached_block *cb = data_to_cached_block(data);
+  if (cb->write_intent) {
+    mark_dirty(cb);
+    cb->write_intent = false;
+  }
+  cache_release(cb);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -372,9 +1797,56 @@ block_type(struct block *block) {
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints the non-empty buckets of HIST, which has BUCKET_CNT buckets, as "LOW+:COUNT" */
+static void
+print_histogram(const char *name, const char *what, const unsigned long long hist[], int bucket_cnt) {
+  int i;
+  printf("%s: %s:", name, what);
+  for (i = 0; i < bucket_cnt; i++) {
+    if (hist[i] != 0) {
+      printf(" %llu+:%llu", i == 0 ? 0ULL : 1ULL << i, hist[i]);
+    }
+  }
+  printf("\n");
+}
+
+/* Prints the request statistics of BLOCK, if it completed any requests */
+static void
+print_io_stats(struct block *block) {
+  struct block_stats s;
+  unsigned long long requests;
+  int i;
+
+  enum intr_level old_level = intr_disable();
+  s = block->stats;
+  intr_set_level(old_level);
+  requests = s.requests[0] + s.requests[1];
+  if (requests == 0) {
+    return;
+  }
+
+  for (i = 0; i < 2; i++) {
+    if (s.requests[i] != 0) {
+      printf("%s: %llu %s requests, %llu us average latency\n", block->name, s.requests[i],
+             i == 0 ? "read" : "write", s.latency_us[i] / s.requests[i]);
+      print_histogram(block->name, i == 0 ? "read latency (us)" : "write latency (us)", s.latency_hist[i],
+                      BLOCK_LATENCY_BUCKETS);
+    }
+  }
+  printf("%s: %llu.%02llu average depth, %u most in flight\n", block->name, s.depth_sum / requests,
+         s.depth_sum * 100 / requests % 100, s.max_in_flight);
+  printf("%s: %llu seeks in %llu transfers, %llu sectors average distance\n", block->name, s.seeks, s.dispatches,
+         s.seeks != 0 ? s.seek_sectors / s.seeks : 0);
+  if (s.seeks != 0) {
+    print_histogram(block->name, "seek distance (sectors)", s.seek_hist, BLOCK_SEEK_BUCKETS);
+  }
+}
+
+/* Prints statistics for each block device used for a Pintos role, the buffer cache, and the request statistics of
+   each device that completed any requests. */
 void
 block_print_stats(void) {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++) {
@@ -385,6 +1857,33 @@ block_print_stats(void) {
              block->read_cnt, block->write_cnt);
     }
   }
+  printf("Buffer cache: %llu hits, %llu misses, %llu evictions, %llu write-backs\n",
+         stats.hits, stats.misses, stats.evictions, stats.write_backs);
+  printf("Buffer cache: %llu read-aheads, %llu used, %llu lock waits for %llu ticks\n",
+         stats.read_aheads, stats.read_ahead_hits, stats.lock_waits, stats.lock_wait_ticks);
+  for (e = list_begin(&all_blocks); e != list_end(&all_blocks); e = list_next(e)) {
+    print_io_stats(list_entry(e, struct block, list_elem));
+  }
+}
+
+/* Copies the request statistics of the Nth registered block device, counting from 0, into *OUT. Returns false if
+   there is no such device */
+bool
+block_get_stats(int n, struct block_stats *out) {
+  struct list_elem *e;
+  for (e = list_begin(&all_blocks); e != list_end(&all_blocks); e = list_next(e)) {
+    if (n-- == 0) {
+      struct block *block = list_entry(e, struct block, list_elem);
+      enum intr_level old_level = intr_disable();
+      *out = block->stats;
+      out->sectors[0] = block->read_cnt;
+      out->sectors[1] = block->write_cnt;
+      intr_set_level(old_level);
+      strlcpy(out->name, block->name, sizeof out->name);
+      return true;
+    }
+  }
+  return false;
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -408,6 +1907,9 @@ block_register(const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queue = NULL;
+  memset(&block->stats, 0, sizeof block->stats);
+  block->next_sector = 0;
 
   printf("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size((uint64_t) block->size * BLOCK_SECTOR_SIZE);
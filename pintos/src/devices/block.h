@@ -3,8 +3,12 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 #include <filesys/off_t.h>
 #include <lib/stdbool.h>
+#include <block-stats.h>
+#include <cache-stats.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -42,8 +46,13 @@ enum block_type
   };
 
 
-void block_cache_init();
+void block_cache_init(void);
+bool block_cache_set_policy(const char *name);
+void block_cache_set_size(size_t blocks);
+void block_cache_set_write_behind(int age_ms, int ratio);
 void flush_block_cache(bool free_cached_blocks);
+void block_cache_get_stats(struct cache_stats *);
+void block_cache_reset(void);
 
 const char *block_type_name (enum block_type);
 
@@ -59,17 +68,89 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_readv (struct block *, block_sector_t, void *const buffers[],
+                  size_t cnt);
+void block_writev (struct block *, block_sector_t, void *const buffers[],
+                   size_t cnt);
+
+/* An asynchronous transfer of CNT consecutive sectors.
+
+   Fill one in with block_request_init(), optionally set COMPLETE
+   and AUX, and pass it to block_submit(), which returns without
+   waiting for the device.  Completion is reported in exactly one
+   of two ways:
+
+     - If COMPLETE is non-null, it is called once the transfer is
+       done.  It may run in an interrupt handler, so it must not
+       sleep, and it is the block layer's last use of the request.
+
+     - Otherwise the submitter can block in block_wait(), or check
+       with block_poll() and get on with other work meanwhile.
+
+   The request and its buffers must stay put until then. */
+struct block_request
+  {
+    /* Set by the submitter. */
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *const *buffers;               /* Nth sector to or from BUFFERS[N]. */
+    bool write;                         /* Write instead of read? */
+    void (*complete) (struct block_request *); /* Completion callback. */
+    void *aux;                          /* For COMPLETE's use. */
+
+    /* Owned by the block layer. */
+    volatile bool done;                 /* Set on completion. */
+    struct semaphore done_sema;         /* Up'd on completion without COMPLETE. */
+    struct list_elem sorted_elem;       /* In a block_queue's sorted list. */
+    struct list_elem fifo_elem;         /* In a block_queue's fifo list. */
+    int64_t deadline;                   /* Tick by which to dispatch it. */
+    struct block *timed_block;          /* Device whose statistics it counts
+                                           against, null if none. */
+    uint64_t submit_tsc;                /* timer_tsc() at submission. */
+
+    /* For the driver's use between submit and completion. */
+    struct list_elem driver_elem;       /* List element. */
+    size_t driver_started;              /* Sectors started. */
+    size_t driver_done;                 /* Sectors done. */
+  };
+
+void block_request_init (struct block_request *, struct block *,
+                         block_sector_t, void *const buffers[], size_t cnt,
+                         bool write);
+void block_submit (struct block_request *);
+bool block_poll (const struct block_request *);
+void block_wait (struct block_request *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 void block_cache_read(struct block *block, block_sector_t sector, void *buffer);
 void block_cache_write(struct block *block, block_sector_t sector, const void *buffer);
+void block_cache_prefetch(struct block *block, block_sector_t sector);
+void block_cache_prefetch_range(struct block *block, block_sector_t sector, block_sector_t cnt);
+
+/* Pinned, in-place access to a cached sector. */
+enum block_cache_intent
+  {
+    BLOCK_CACHE_READ,            /* Caller only reads the sector. */
+    BLOCK_CACHE_WRITE            /* Caller modifies it; marked dirty on put. */
+  };
+
+void *block_cache_get(struct block *block, block_sector_t sector, enum block_cache_intent intent);
+void block_cache_mark_dirty(void *data);
+void block_cache_put(void *data);
 void block_cache_read_offset(struct block *block, block_sector_t sector, void *buffer, off_t offset, size_t num_bytes);
 void block_cache_write_offset(struct block *block, block_sector_t sector, const void *buffer, off_t offset,
                               size_t num_bytes);
 
+/* Keeping the cache coherent with direct I/O. */
+void block_cache_write_back_range(struct block *block, block_sector_t sector, block_sector_t cnt);
+void block_cache_update_range(struct block *block, block_sector_t sector, void *const buffers[],
+                              block_sector_t cnt);
+
 /* Statistics. */
 void block_print_stats (void);
+bool block_get_stats (int n, struct block_stats *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -77,10 +158,40 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors starting at the
+       given sector, the Nth of them to or from BUFFERS[N].  If
+       null, the block layer does one read or write per sector. */
+    void (*readv) (void *aux, block_sector_t, void *const buffers[],
+                   size_t cnt);
+    void (*writev) (void *aux, block_sector_t, void *const buffers[],
+                    size_t cnt);
+
+    /* Optional.  Starts request R and returns at once, calling
+       block_request_complete() once R is done, usually from the
+       device's interrupt handler.  Always called with interrupts
+       off, in one of two modes:
+
+         - For a device behind a block_queue, which requires this
+           operation, only when no other request of the queue is
+           outstanding.  The queue sorts and merges what waits.
+
+         - For a device without a queue, directly from
+           block_submit(), with any number of the device's
+           requests already in flight.  Only drivers that keep
+           their own list of waiting requests, like virtio-blk,
+           may leave their devices without a queue. */
+    void (*submit) (void *aux, struct block_request *r);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
 
+/* Request queues, for drivers whose devices should see sorted
+   and merged requests. */
+struct block_queue *block_queue_create (const char *name);
+void block_set_queue (struct block *, struct block_queue *);
+void block_request_complete (struct block_request *);
+
 #endif /* devices/block.h */
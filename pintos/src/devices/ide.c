@@ -5,13 +5,23 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Data moves by PIO, through the data register, unless the
+   channel has a PCI bus-master IDE function, as the PIIX3 and
+   PIIX4 that QEMU and Bochs emulate do.  Then requests submitted
+   by the block layer move by DMA, straight between the disk and
+   memory, and the CPU only sets up each command and fields one
+   interrupt at its end. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +44,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +60,48 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus-master IDE port addresses, in the I/O range given by BAR 4
+   of the controller's PCI function, 8 ports per channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error; write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt; write 1 to clear. */
+
+/* Physical Region Descriptor: a physically contiguous buffer
+   that must not cross a 64 kB boundary.  The controller works
+   through a table of these, up to one with PRD_EOT set. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Bytes, even; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT or 0. */
+  };
+#define PRD_EOT 0x8000          /* Last entry of the table. */
+
+/* A PRD table fills a page, which does not cross a 64 kB
+   boundary, as a table must not.  Each sector needs at most two
+   entries, so a page is enough for any command. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Most sectors moved by one command.  The sector count register
+   is 8 bits wide, with 0 meaning 256. */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/* Most sectors per DRQ block we ask for in multiple mode. */
+#define MAX_MULTIPLE 16
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +110,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, 0 if not in multiple mode. */
+    bool dma;                   /* Supports READ/WRITE DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +127,19 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct block_queue *queue;  /* Requests for both devices. */
+
+    /* Asynchronous request being carried out by the interrupt
+       handler, if any.  See ide_submit(). */
+    struct block_request *request;      /* Request, or null. */
+    struct ata_disk *request_disk;      /* Its disk. */
+    size_t request_pos;                 /* Sectors transferred so far. */
+    size_t command_end;                 /* REQUEST_POS at end of command. */
+    bool dma_active;                    /* Current command uses DMA? */
+
+    /* Bus master, if there is one. */
+    uint16_t bm_base;           /* Base I/O port, or 0 if none. */
+    struct prd *prdt;           /* PRD table. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,18 +150,31 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+bool ide_dma_enabled = true;
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int max_multiple);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt,
+                            bool spin);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void find_bus_master (void);
+static bool build_prdt (struct channel *);
+static void start_command (struct channel *);
+static void transfer_block (struct channel *);
+static void continue_request (struct channel *, uint8_t status);
+
 static void wait_until_idle (const struct ata_disk *);
+static void spin_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool spin_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
+static void select_device_spin (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
@@ -103,6 +185,11 @@ ide_init (void)
 {
   size_t chan_no;
 
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    channels[chan_no].bm_base = 0;
+  if (ide_dma_enabled)
+    find_bus_master ();
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -126,6 +213,8 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->queue = block_queue_create (c->name);
+      c->request = NULL;
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +225,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +246,43 @@ ide_init (void)
     }
 }
 
+/* Looks for a PCI IDE controller that can be a bus master and,
+   if there is one, sets up both legacy channels to use it. */
+static void
+find_bus_master (void)
+{
+  struct pci_address a;
+  uint32_t bar;
+  size_t chan_no;
+
+  /* Class 1, subclass 1 is an IDE controller.  Bit 7 of its
+     programming interface says whether it can be a bus master. */
+  if (!pci_find_class (0x01, 0x01, &a)
+      || !(pci_read_config (a, PCI_REG_CLASS) & 0x8000))
+    return;
+  bar = pci_read_config (a, PCI_REG_BAR (4));
+  if (!(bar & PCI_BAR_IO) || (bar & ~3u) == 0)
+    return;
+
+  /* Let it drive the bus. */
+  pci_write_config (a, PCI_REG_COMMAND,
+                    (pci_read_config (a, PCI_REG_COMMAND) & 0xffff)
+                    | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      c->prdt = palloc_get_page (0);
+      if (c->prdt == NULL)
+        continue;
+      c->bm_base = (bar & ~3u) + 8 * chan_no;
+      outb (reg_bm_command (c), 0);
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+    }
+  printf ("ide: bus-master DMA at %02x:%02x.%x, ports 0x%04x\n",
+          a.bus, a.dev, a.func, (unsigned) (bar & ~3u));
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -281,13 +409,21 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
+  /* Word 47 holds the most sectors per DRQ block the disk can
+     move in multiple mode. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Bit 8 of word 49 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,9 +442,34 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_set_queue (block, c->queue);
   partition_scan (block);
 }
 
+/* Puts disk D into multiple mode with the largest power of two
+   sectors per DRQ block that is at most MAX_MULTIPLE and at most
+   the disk's own limit DISK_MAX.  Leaves D->multiple 0 if the
+   disk does not support it. */
+static void
+set_multiple_mode (struct ata_disk *d, int disk_max)
+{
+  struct channel *c = d->channel;
+  int multiple = MAX_MULTIPLE;
+
+  while (multiple > disk_max)
+    multiple /= 2;
+  if (multiple <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_status (c)) & STA_ERR))
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +498,325 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D, the Nth
+   of them into BUFFERS[N], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Each command moves up to
+   MAX_SECTORS_PER_COMMAND sectors, and in multiple mode the disk
+   interrupts once per D->multiple sectors instead of once per
+   sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_readv (void *d_, block_sector_t sec_no, void *const buffers[],
+           size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_interrupt = d->multiple > 0 ? d->multiple : 1;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+      size_t i;
+
+      select_sectors (d, sec_no, n, false);
+      issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                            : CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          if (i % per_interrupt == 0)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+            }
+          input_sector (c, buffers[i]);
+        }
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D, the Nth
+   of them from BUFFERS[N], which must contain BLOCK_SECTOR_SIZE
+   bytes.  Returns after the disk has acknowledged receiving the
+   data.  Batches sectors into commands and interrupts as
+   ide_readv() does.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_writev (void *d_, block_sector_t sec_no, void *const buffers[],
+            size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  size_t per_interrupt = d->multiple > 0 ? d->multiple : 1;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+      size_t i;
+
+      select_sectors (d, sec_no, n, false);
+      issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                            : CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          if (i % per_interrupt == 0)
+            {
+              /* The disk asks for the first block right away and
+                 interrupts for each one after that. */
+              if (i > 0)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+            }
+          output_sector (c, buffers[i]);
+        }
+      sema_down (&c->completion_wait);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_readv (d, sec_no, &buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  void *sector = (void *) buffer;
+  ide_writev (d, sec_no, &sector, 1);
+}
+
+/* Starts request R on disk D and returns without waiting for
+   it.  The interrupt handler moves the data as the disk asks for
+   it, issuing as many commands as R needs, and calls
+   block_request_complete() after the last one.
+
+   The block layer calls this with interrupts off and only while
+   no other request of D's channel is outstanding, which is what
+   c->lock ensures for the synchronous functions above. */
+static void
+ide_submit (void *d_, struct block_request *r)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->request == NULL);
+  ASSERT (r->cnt > 0);
+
+  c->request = r;
+  c->request_disk = d;
+  c->request_pos = 0;
+  start_command (c);
+}
+
+/* Fills in channel C's PRD table for the sectors of its request
+   from REQUEST_POS up to COMMAND_END.  Returns false, leaving the
+   command to PIO, if a buffer is not in kernel memory or not
+   word-aligned, as DMA requires. */
+static bool
+build_prdt (struct channel *c)
+{
+  struct block_request *r = c->request;
+  struct prd *prd = NULL;
+  size_t i;
+
+  for (i = c->request_pos; i < c->command_end; i++)
+    {
+      const uint8_t *buffer = r->buffers[i];
+      uintptr_t addr;
+      size_t left = BLOCK_SECTOR_SIZE;
+
+      if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+        return false;
+      addr = vtop (buffer);
+      while (left > 0)
+        {
+          /* Up to the next 64 kB boundary. */
+          size_t size = 0x10000 - addr % 0x10000;
+          if (size > left)
+            size = left;
+
+          /* Extend the last entry if this picks up where it left
+             off, short of a boundary; otherwise start another. */
+          if (prd != NULL && prd->addr + prd->size == addr
+              && addr % 0x10000 != 0)
+            prd->size += size;
+          else
+            {
+              prd = prd == NULL ? c->prdt : prd + 1;
+              ASSERT (prd < c->prdt + PRD_CNT);
+              prd->addr = addr;
+              prd->size = size;
+              prd->flags = 0;
+            }
+          addr += size;
+          left -= size;
+        }
+    }
+  prd->flags = PRD_EOT;
+  return true;
+}
+
+/* Issues the command for the next MAX_SECTORS_PER_COMMAND or
+   fewer sectors of channel C's request, as DMA if C and the disk
+   support it.  For a PIO write, also sends the first block of
+   data, which the disk asks for without an interrupt.
+   Runs with interrupts off, from ide_submit() or the interrupt
+   handler, so it only busy-waits. */
+static void
+start_command (struct channel *c)
+{
+  struct block_request *r = c->request;
+  struct ata_disk *d = c->request_disk;
+  size_t n = r->cnt - c->request_pos;
+
+  if (n > MAX_SECTORS_PER_COMMAND)
+    n = MAX_SECTORS_PER_COMMAND;
+  c->command_end = c->request_pos + n;
+  c->dma_active = d->dma && build_prdt (c);
+
+  select_sectors (d, r->sector + c->request_pos, n, true);
+  c->expecting_interrupt = true;
+  if (c->dma_active)
+    {
+      uint8_t direction = r->write ? 0 : BM_CMD_READ;
+
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+      outb (reg_bm_command (c), direction);
+      outb (reg_command (c), r->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), direction | BM_CMD_START);
+    }
+  else if (!r->write)
+    outb (reg_command (c), d->multiple > 0 ? CMD_READ_MULTIPLE
+                                          : CMD_READ_SECTOR_RETRY);
+  else
+    {
+      outb (reg_command (c), d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                            : CMD_WRITE_SECTOR_RETRY);
+      if (!spin_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, r->sector + c->request_pos);
+      transfer_block (c);
+    }
+}
+
+/* Moves the next DRQ block, one sector or one multiple-mode
+   block, of channel C's request through the data register. */
+static void
+transfer_block (struct channel *c)
+{
+  struct block_request *r = c->request;
+  struct ata_disk *d = c->request_disk;
+  size_t n = c->command_end - c->request_pos;
+  size_t i;
+
+  if (d->multiple > 0 && n > (size_t) d->multiple)
+    n = d->multiple;
+  else if (d->multiple == 0)
+    n = 1;
+  for (i = 0; i < n; i++)
+    if (r->write)
+      output_sector (c, r->buffers[c->request_pos + i]);
+    else
+      input_sector (c, r->buffers[c->request_pos + i]);
+  c->request_pos += n;
+}
+
+/* Advances channel C's request on an interrupt from its disk,
+   which reported STATUS.  A DMA interrupt means the command is
+   done.  A PIO read interrupt means a block is ready to input; a
+   PIO write interrupt means the disk wants the next block or,
+   after the last one, that the command is done. */
+static void
+continue_request (struct channel *c, uint8_t status)
+{
+  struct block_request *r = c->request;
+
+  if (c->dma_active)
+    {
+      uint8_t bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_command (c), 0);
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+      if (bm_status & BM_STA_ERR)
+        status |= STA_ERR;
+    }
+
+  if (status & STA_ERR)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu, c->request_disk->name,
+           r->write ? "write" : "read", r->sector + c->request_pos);
+
+  if (c->dma_active)
+    c->request_pos = c->command_end;
+  else if (!r->write || c->request_pos < c->command_end)
+    {
+      transfer_block (c);
+      if (c->request_pos < c->command_end || r->write)
+        return;
+    }
+
+  if (c->request_pos < r->cnt)
+    start_command (c);
+  else
+    {
+      c->request = NULL;
+      c->expecting_interrupt = false;
+      block_request_complete (r);
+    }
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    ide_submit
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_SECTORS_PER_COMMAND, to the disk's sector selection
+   registers.  (We use LBA mode.)  If SPIN, busy-waits instead
+   of sleeping, for callers with interrupts off. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                bool spin)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
+  ASSERT (sec_no + cnt <= (1UL << 28));
 
-  select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  if (spin)
+    {
+      spin_until_idle (d);
+      select_device_spin (d);
+      spin_until_idle (d);
+    }
+  else
+    select_device_wait (d);
+  outb (reg_nsect (c), cnt % MAX_SECTORS_PER_COMMAND);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -452,6 +875,23 @@ wait_until_idle (const struct ata_disk *d)
   printf ("%s: idle timeout\n", d->name);
 }
 
+/* Like wait_until_idle(), but busy-waits instead of sleeping, so
+   that it may be used with interrupts off. */
+static void
+spin_until_idle (const struct ata_disk *d)
+{
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
+        return;
+      timer_udelay (10);
+    }
+
+  printf ("%s: idle timeout\n", d->name);
+}
+
 /* Wait up to 30 seconds for disk D to clear BSY,
    and then return the status of the DRQ bit.
    The ATA standards say that a disk may take as long as that to
@@ -479,9 +919,28 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
-/* Program D's channel so that D is now the selected disk. */
+/* Like wait_while_busy(), but spins for up to a second instead of
+   sleeping, so that it may be used with interrupts off. */
+static bool
+spin_while_busy (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 100000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
+/* Program D's channel so that D is now the selected disk,
+   without the wait that must follow. */
 static void
-select_device (const struct ata_disk *d)
+write_device_register (const struct ata_disk *d)
 {
   struct channel *c = d->channel;
   uint8_t dev = DEV_MBS;
@@ -489,9 +948,25 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
+}
+
+/* Program D's channel so that D is now the selected disk. */
+static void
+select_device (const struct ata_disk *d)
+{
+  write_device_register (d);
   timer_nsleep (400);
 }
 
+/* Like select_device(), but busy-waits instead of sleeping, so
+   that it may be used with interrupts off. */
+static void
+select_device_spin (const struct ata_disk *d)
+{
+  write_device_register (d);
+  timer_ndelay (400);
+}
+
 /* Select disk D in its channel, as select_device(), but wait for
    the channel to become idle before and after. */
 static void
@@ -513,8 +988,11 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt)
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            uint8_t status = inb (reg_status (c)); /* Acknowledge interrupt. */
+            if (c->request != NULL)
+              continue_request (c, status);     /* Carry on with request. */
+            else
+              sema_up (&c->completion_wait);    /* Wake up waiter. */
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -1,6 +1,12 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* Use bus-master DMA where the controller supports it?
+   Cleared by the -no-dma kernel option. */
+extern bool ide_dma_enabled;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
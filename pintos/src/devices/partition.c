@@ -317,8 +317,43 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads the CNT sectors starting at SECTOR from partition P,
+   the Nth of them into BUFFERS[N]. */
+static void
+partition_readv (void *p_, block_sector_t sector, void *const buffers[],
+                 size_t cnt)
+{
+  struct partition *p = p_;
+  block_readv (p->block, p->start + sector, buffers, cnt);
+}
+
+/* Writes the CNT sectors starting at SECTOR to partition P, the
+   Nth of them from BUFFERS[N]. */
+static void
+partition_writev (void *p_, block_sector_t sector, void *const buffers[],
+                  size_t cnt)
+{
+  struct partition *p = p_;
+  block_writev (p->block, p->start + sector, buffers, cnt);
+}
+
+/* Starts request R for partition P by handing it to the
+   underlying device, so from here on R's BLOCK and SECTOR refer
+   to that device. */
+static void
+partition_submit (void *p_, struct block_request *r)
+{
+  struct partition *p = p_;
+  r->block = p->block;
+  r->sector += p->start;
+  block_submit (r);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_readv,
+    partition_writev,
+    partition_submit
   };
@@ -0,0 +1,109 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, which every PC chipset Pintos runs on supports.
+   Just enough to find a controller and program it; Pintos does
+   not enumerate or configure the bus itself, but takes what the
+   BIOS set up. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /* Reads or writes it. */
+
+/* Selects configuration register REG of function A. */
+static void
+select_register (struct pci_address a, uint8_t reg)
+{
+  ASSERT (a.dev < 32 && a.func < 8);
+  ASSERT (reg % 4 == 0);
+
+  outl (PCI_CONFIG_ADDRESS, (1u << 31) | (a.bus << 16) | (a.dev << 11)
+                            | (a.func << 8) | reg);
+}
+
+/* Returns configuration register REG of function A, which reads
+   as all 1-bits if there is no such function. */
+uint32_t
+pci_read_config (struct pci_address a, uint8_t reg)
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t value;
+
+  select_register (a, reg);
+  value = inl (PCI_CONFIG_DATA);
+  intr_set_level (old_level);
+  return value;
+}
+
+/* Writes VALUE to configuration register REG of function A. */
+void
+pci_write_config (struct pci_address a, uint8_t reg, uint32_t value)
+{
+  enum intr_level old_level = intr_disable ();
+
+  select_register (a, reg);
+  outl (PCI_CONFIG_DATA, value);
+  intr_set_level (old_level);
+}
+
+/* Searches every bus for the Nth function, counting from 0, whose
+   configuration register REG, masked with MASK, equals VALUE.  If
+   there is one, stores its address in *A and returns true;
+   otherwise returns false. */
+static bool
+find_nth (uint8_t reg, uint32_t mask, uint32_t value, int n,
+          struct pci_address *a)
+{
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          struct pci_address at = { bus, dev, func };
+
+          if ((pci_read_config (at, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No device, or no such function of it. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if ((pci_read_config (at, reg) & mask) == value && n-- == 0)
+            {
+              *a = at;
+              return true;
+            }
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (at, PCI_REG_HEADER) & 0x800000))
+            break;
+        }
+  return false;
+}
+
+/* Searches every bus for the first function whose class and
+   subclass codes are CLASS and SUBCLASS.  If there is one, stores
+   its address in *A and returns true; otherwise returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_address *a)
+{
+  return find_nth (PCI_REG_CLASS, 0xffff0000,
+                   ((uint32_t) class << 24) | (subclass << 16), 0, a);
+}
+
+/* Searches every bus for the Nth function, counting from 0, with
+   the given VENDOR and DEVICE IDs.  If there is one, stores its
+   address in *A and returns true; otherwise returns false. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int n,
+                 struct pci_address *a)
+{
+  return find_nth (PCI_REG_ID, 0xffffffff,
+                   ((uint32_t) device << 16) | vendor, n, a);
+}
@@ -0,0 +1,40 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function of a device on a PCI bus. */
+struct pci_address
+  {
+    uint8_t bus;                /* Bus, 0...255. */
+    uint8_t dev;                /* Device on the bus, 0...31. */
+    uint8_t func;               /* Function of the device, 0...7. */
+  };
+
+/* Offsets of configuration space registers common to all
+   functions.  Each names the aligned 32-bit register holding the
+   field. */
+#define PCI_REG_ID 0x00         /* Device ID (31:16), vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04    /* Status (31:16), command (15:0). */
+#define PCI_REG_CLASS 0x08      /* Class (31:24), subclass (23:16),
+                                   programming interface (15:8). */
+#define PCI_REG_HEADER 0x0c     /* Header type (23:16). */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N))  /* Base address register N. */
+#define PCI_REG_INTERRUPT 0x3c  /* Interrupt line (7:0). */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_COMMAND_MASTER 0x0004   /* May act as bus master. */
+
+/* A base address register with this bit set maps I/O ports. */
+#define PCI_BAR_IO 0x1
+
+uint32_t pci_read_config (struct pci_address, uint8_t reg);
+void pci_write_config (struct pci_address, uint8_t reg, uint32_t);
+bool pci_find_class (uint8_t class, uint8_t subclass,
+                     struct pci_address *);
+bool pci_find_device (uint16_t vendor, uint16_t device, int n,
+                      struct pci_address *);
+
+#endif /* devices/pci.h */
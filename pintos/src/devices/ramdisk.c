@@ -0,0 +1,107 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory, called "ramdisk".  Reads and
+   writes are plain copies, so file system tests and benchmarks
+   run on it measure the file system and buffer cache without any
+   emulated disk latency.  Its contents last until shutdown. */
+
+/* Sectors per page of RAM disk. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *ramdisk;   /* The RAM disk, if any. */
+static uint8_t **pages;         /* Its pages, PAGE_SECTORS sectors each. */
+static size_t page_cnt;         /* Number of pages. */
+
+/* Returns the memory holding sector SEC_NO. */
+static uint8_t *
+sector_data (block_sector_t sec_no)
+{
+  return (pages[sec_no / PAGE_SECTORS]
+          + sec_no % PAGE_SECTORS * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SEC_NO into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sec_no, void *buffer)
+{
+  memcpy (buffer, sector_data (sec_no), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SEC_NO from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sec_no, const void *buffer)
+{
+  memcpy (sector_data (sec_no), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+  };
+
+/* Creates and registers a zeroed RAM disk of SIZE_KB kB, rounded
+   up to a whole page, from the kernel pool.  Panics if there is
+   not enough memory. */
+void
+ramdisk_init (size_t size_kb)
+{
+  char extra_info[32];
+  size_t i;
+
+  ASSERT (ramdisk == NULL);
+  ASSERT (size_kb > 0);
+
+  page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ramdisk: out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ramdisk: out of memory after %zu of %zu kB",
+               i * PGSIZE / 1024, page_cnt * PGSIZE / 1024);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "%zu kB in memory",
+            page_cnt * PGSIZE / 1024);
+  ramdisk = block_register ("ramdisk", BLOCK_RAW, extra_info,
+                            page_cnt * PAGE_SECTORS,
+                            &ramdisk_operations, NULL);
+}
+
+/* Copies as much of block device SRC, from its start, as fits
+   into the RAM disk, which must have been created already. */
+void
+ramdisk_load (struct block *src)
+{
+  block_sector_t sector_cnt;
+  block_sector_t sec_no;
+
+  ASSERT (ramdisk != NULL);
+
+  if (src == NULL)
+    PANIC ("ramdisk: no device to load from");
+  sector_cnt = block_size (src);
+  if (sector_cnt > block_size (ramdisk))
+    sector_cnt = block_size (ramdisk);
+
+  printf ("ramdisk: loading %"PRDSNu" sectors from %s\n",
+          sector_cnt, block_name (src));
+  for (sec_no = 0; sec_no < sector_cnt; sec_no++)
+    block_read (src, sec_no, sector_data (sec_no));
+}
@@ -24,6 +24,11 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Number of time-stamp counter cycles per timer tick, measured
+   over TSC_CALIBRATION_TICKS ticks by timer_calibrate(). */
+static uint64_t tsc_per_tick;
+#define TSC_CALIBRATION_TICKS 4
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -44,6 +49,8 @@ void
 timer_calibrate (void)
 {
   unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t start_tsc;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -64,6 +71,19 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Time the CPU's time-stamp counter over a few ticks, starting
+     at a tick boundary. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+  start_tsc = timer_tsc ();
+  start = timer_ticks ();
+  while (timer_elapsed (start) < TSC_CALIBRATION_TICKS)
+    continue;
+  tsc_per_tick = (timer_tsc () - start_tsc) / TSC_CALIBRATION_TICKS;
+  printf ("Time-stamp counter runs at %'"PRIu64" cycles/s.\n",
+          tsc_per_tick * TIMER_FREQ);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,6 +104,26 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles since reset. */
+uint64_t
+timer_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Converts TSC, a difference of timer_tsc() values, to
+   microseconds.  Returns 0 before timer_calibrate(). */
+uint64_t
+timer_tsc_to_us (uint64_t tsc)
+{
+  if (tsc_per_tick == 0)
+    return 0;
+  return tsc * (1000 * 1000 / TIMER_FREQ) / tsc_per_tick;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -12,6 +12,8 @@ void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+uint64_t timer_tsc (void);
+uint64_t timer_tsc_to_us (uint64_t tsc);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
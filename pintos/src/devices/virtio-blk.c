@@ -0,0 +1,480 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices, as
+   QEMU provides with "-drive if=virtio", through the legacy PCI
+   interface of [VIRTIO].
+
+   Unlike an IDE channel, which takes one command at a time, a
+   virtio disk has a queue of requests shared with the host.  The
+   driver puts each request the block layer submits in the queue
+   as soon as there are descriptors for it, so many can be in
+   flight at once, and the host completes them in whatever order
+   it likes. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, in the I/O range given by BAR 0. */
+#define reg_guest_features(DISK) ((DISK)->io_base + 0x04) /* Features. */
+#define reg_queue_pfn(DISK) ((DISK)->io_base + 0x08)      /* Ring page. */
+#define reg_queue_size(DISK) ((DISK)->io_base + 0x0c)     /* Ring size. */
+#define reg_queue_select(DISK) ((DISK)->io_base + 0x0e)   /* Ring index. */
+#define reg_queue_notify(DISK) ((DISK)->io_base + 0x10)   /* Kick ring. */
+#define reg_status(DISK) ((DISK)->io_base + 0x12)         /* Status. */
+#define reg_isr(DISK) ((DISK)->io_base + 0x13)            /* Int. status. */
+#define reg_capacity(DISK) ((DISK)->io_base + 0x14)       /* Sectors. */
+
+/* Device Status Register bits. */
+#define STATUS_ACK 0x01         /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver has given up on it. */
+
+/* ISR Status Register bits. */
+#define ISR_QUEUE 0x01          /* Used ring has new entries. */
+
+/* A descriptor: one physically contiguous buffer of a request. */
+struct virtq_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VIRTQ_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VIRTQ_DESC_F_NEXT 1     /* Request continues in NEXT. */
+#define VIRTQ_DESC_F_WRITE 2    /* Device writes, rather than reads. */
+
+/* Ring of requests, by first descriptor, that the driver offers. */
+struct virtq_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next one. */
+    uint16_t ring[];
+  };
+
+/* Ring of requests the device is done with. */
+struct virtq_used_elem
+  {
+    uint32_t id;                /* First descriptor of the request. */
+    uint32_t len;               /* Bytes the device wrote. */
+  };
+struct virtq_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next one. */
+    struct virtq_used_elem ring[];
+  };
+
+/* Header that starts every virtio block request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Status byte of a successful request. */
+
+/* Most sectors in one virtio request.  A block_request for more
+   goes to the device in pieces. */
+#define MAX_SECTORS_PER_REQUEST 64
+
+/* A virtio request in flight, indexed by its first descriptor. */
+struct slot
+  {
+    struct block_request *request;      /* Request this is part of. */
+    size_t cnt;                         /* Number of sectors. */
+    struct virtio_blk_header header;    /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    struct block *block;        /* Block device. */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt in use. */
+
+    /* Request queue 0, the only one. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct virtq_desc *desc;    /* Descriptor table. */
+    struct virtq_avail *avail;  /* Available ring. */
+    volatile struct virtq_used *used;   /* Used ring. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+    uint16_t used_idx;          /* Next used ring entry to handle. */
+    size_t max_sectors;         /* Most sectors per virtio request. */
+    struct slot *slots;         /* One per descriptor. */
+    struct list waiting;        /* block_requests with sectors that
+                                   have not been put in the queue. */
+  };
+
+/* We support a handful of disks, like the four IDE ones. */
+#define MAX_DISKS 4
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+/* Interrupts we have registered interrupt_handler() for. */
+static bool irq_registered[16];
+
+static struct block_operations virtio_operations;
+
+static bool setup_disk (struct virtio_disk *, struct pci_address);
+static bool setup_queue (struct virtio_disk *);
+static void start_waiting (struct virtio_disk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and initializes virtio block devices. */
+void
+virtio_blk_init (void)
+{
+  struct pci_address a;
+  int n;
+
+  for (n = 0; disk_cnt < MAX_DISKS
+              && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, n, &a);
+       n++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (!setup_disk (d, a))
+        printf ("%s: virtio device at %02x:%02x.%x unusable\n",
+                d->name, a.bus, a.dev, a.func);
+    }
+}
+
+/* Brings up the virtio block device at A as disk D, registers it,
+   and scans it for partitions.  Returns false on failure. */
+static bool
+setup_disk (struct virtio_disk *d, struct pci_address a)
+{
+  uint32_t bar = pci_read_config (a, PCI_REG_BAR (0));
+  uint8_t line = pci_read_config (a, PCI_REG_INTERRUPT) & 0xff;
+  uint32_t capacity_lo, capacity_hi;
+  char extra_info[32];
+
+  if (!(bar & PCI_BAR_IO) || line >= 16)
+    return false;
+  d->io_base = bar & ~3u;
+  d->irq = 0x20 + line;
+  pci_write_config (a, PCI_REG_COMMAND,
+                    (pci_read_config (a, PCI_REG_COMMAND) & 0xffff)
+                    | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  /* Reset the device and tell it that we know how to drive it.
+     We need none of its optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACK);
+  outb (reg_status (d), STATUS_ACK | STATUS_DRIVER);
+  outl (reg_guest_features (d), 0);
+
+  /* Set up its request queue. */
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < 3 || !setup_queue (d))
+    {
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+  outl (reg_queue_pfn (d), vtop (d->desc) / PGSIZE);
+
+  if (!irq_registered[line])
+    {
+      intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+      irq_registered[line] = true;
+    }
+  outb (reg_status (d), STATUS_ACK | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Block devices address at most 2**32 sectors. */
+  capacity_lo = inl (reg_capacity (d));
+  capacity_hi = inl (reg_capacity (d) + 4);
+  if (capacity_hi != 0)
+    capacity_lo = UINT32_MAX;
+
+  snprintf (extra_info, sizeof extra_info, "virtio, queue %u",
+            (unsigned) d->queue_size);
+  disk_cnt++;
+  d->block = block_register (d->name, BLOCK_RAW, extra_info, capacity_lo,
+                             &virtio_operations, d);
+  partition_scan (d->block);
+  return true;
+}
+
+/* Allocates disk D's descriptor table and rings, laid out the way
+   a legacy device expects: the table and the available ring, and
+   then the used ring starting on a page of its own. */
+static bool
+setup_queue (struct virtio_disk *d)
+{
+  size_t n = d->queue_size;
+  size_t avail_end = (n * sizeof (struct virtq_desc)
+                      + sizeof (struct virtq_avail)
+                      + (n + 1) * sizeof (uint16_t));
+  size_t used_ofs = ROUND_UP (avail_end, PGSIZE);
+  size_t used_end = (used_ofs + sizeof (struct virtq_used)
+                     + n * sizeof (struct virtq_used_elem)
+                     + sizeof (uint16_t));
+  size_t page_cnt = DIV_ROUND_UP (used_end, PGSIZE);
+  uint8_t *ring;
+  size_t i;
+
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->slots = malloc (n * sizeof *d->slots);
+  if (ring == NULL || d->slots == NULL)
+    {
+      if (ring != NULL)
+        palloc_free_multiple (ring, page_cnt);
+      free (d->slots);
+      return false;
+    }
+
+  d->desc = (struct virtq_desc *) ring;
+  d->avail = (struct virtq_avail *) (ring + n * sizeof (struct virtq_desc));
+  d->used = (struct virtq_used *) (ring + used_ofs);
+  for (i = 0; i < n; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = n;
+  d->used_idx = 0;
+  d->max_sectors = (n - 2 < MAX_SECTORS_PER_REQUEST
+                    ? n - 2 : MAX_SECTORS_PER_REQUEST);
+  list_init (&d->waiting);
+  return true;
+}
+
+/* Takes a free descriptor of disk D for the LEN bytes at
+   physical address ADDR, with the given FLAGS, and chains it
+   after PREV unless PREV is null.  Returns it. */
+static struct virtq_desc *
+add_desc (struct virtio_disk *d, struct virtq_desc *prev,
+          uint64_t addr, uint32_t len, uint16_t flags)
+{
+  uint16_t i = d->free_head;
+  struct virtq_desc *desc = &d->desc[i];
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = desc->next;
+  d->free_cnt--;
+
+  desc->addr = addr;
+  desc->len = len;
+  desc->flags = flags;
+  desc->next = 0;
+  if (prev != NULL)
+    {
+      prev->flags |= VIRTQ_DESC_F_NEXT;
+      prev->next = i;
+    }
+  return desc;
+}
+
+/* Returns the chain of descriptors starting at HEAD to disk D's
+   free list. */
+static void
+free_chain (struct virtio_disk *d, uint16_t head)
+{
+  uint16_t i = head;
+
+  for (;;)
+    {
+      struct virtq_desc *desc = &d->desc[i];
+      bool more = (desc->flags & VIRTQ_DESC_F_NEXT) != 0;
+      uint16_t next = desc->next;
+
+      desc->next = d->free_head;
+      d->free_head = i;
+      d->free_cnt++;
+      if (!more)
+        break;
+      i = next;
+    }
+}
+
+/* Offers disk D a request for the next CNT sectors of R: the
+   header, the sector buffers, merged where they are physically
+   adjacent, and the status byte.  D must have CNT + 2 free
+   descriptors. */
+static void
+start_request (struct virtio_disk *d, struct block_request *r, size_t cnt)
+{
+  uint16_t head = d->free_head;
+  struct slot *s = &d->slots[head];
+  struct virtq_desc *header, *last;
+  size_t i;
+
+  s->request = r;
+  s->cnt = cnt;
+  s->header.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = r->sector + r->driver_started;
+  s->status = 0xff;
+
+  header = last = add_desc (d, NULL, vtop (&s->header), sizeof s->header, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      uint64_t addr = vtop (r->buffers[r->driver_started + i]);
+      if (last != header && last->addr + last->len == addr)
+        last->len += BLOCK_SECTOR_SIZE;
+      else
+        last = add_desc (d, last, addr, BLOCK_SECTOR_SIZE,
+                         r->write ? 0 : VIRTQ_DESC_F_WRITE);
+    }
+  add_desc (d, last, vtop (&s->status), 1, VIRTQ_DESC_F_WRITE);
+
+  /* The device may look at the ring entry as soon as it sees the
+     new index. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+}
+
+/* Puts as many of the sectors of disk D's waiting requests in its
+   queue as its free descriptors allow, oldest request first, and
+   lets the device know.  Interrupts must be off. */
+static void
+start_waiting (struct virtio_disk *d)
+{
+  bool started = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  while (!list_empty (&d->waiting))
+    {
+      struct block_request *r = list_entry (list_front (&d->waiting),
+                                            struct block_request,
+                                            driver_elem);
+      size_t cnt = r->cnt - r->driver_started;
+
+      if (cnt > d->max_sectors)
+        cnt = d->max_sectors;
+      if (d->free_cnt < cnt + 2)
+        break;
+      start_request (d, r, cnt);
+      r->driver_started += cnt;
+      if (r->driver_started == r->cnt)
+        list_pop_front (&d->waiting);
+      started = true;
+    }
+
+  if (started)
+    {
+      barrier ();
+      outw (reg_queue_notify (d), 0);
+    }
+}
+
+/* Handles the requests disk D has finished, completing each
+   block_request once all of its sectors are done, and then
+   starts whatever was waiting for their descriptors. */
+static void
+finish_used (struct virtio_disk *d)
+{
+  for (;;)
+    {
+      struct slot *s;
+      struct block_request *r;
+      uint16_t head;
+
+      barrier ();
+      if (d->used_idx == d->used->idx)
+        break;
+      head = d->used->ring[d->used_idx % d->queue_size].id;
+      d->used_idx++;
+
+      s = &d->slots[head];
+      r = s->request;
+      if (s->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               r->write ? "write" : "read", (block_sector_t) s->header.sector);
+      free_chain (d, head);
+
+      r->driver_done += s->cnt;
+      if (r->driver_done == r->cnt)
+        block_request_complete (r);
+    }
+  start_waiting (d);
+}
+
+/* Queues R on disk D.  See the submit member of struct
+   block_operations. */
+static void
+virtio_submit (void *d_, struct block_request *r)
+{
+  struct virtio_disk *d = d_;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  r->driver_started = 0;
+  r->driver_done = 0;
+  list_push_back (&d->waiting, &r->driver_elem);
+  start_waiting (d);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  struct virtio_disk *d = d_;
+  struct block_request r;
+
+  block_request_init (&r, d->block, sec_no, &buffer, 1, false);
+  block_submit (&r);
+  block_wait (&r);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the device has written
+   it. */
+static void
+virtio_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  struct virtio_disk *d = d_;
+  void *sector = (void *) buffer;
+  struct block_request r;
+
+  block_request_init (&r, d->block, sec_no, &sector, 1, true);
+  block_submit (&r);
+  block_wait (&r);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    NULL,
+    NULL,
+    virtio_submit
+  };
+
+/* Virtio interrupt handler, shared by all the disks on the same
+   interrupt line.  Reading a disk's ISR register acknowledges its
+   interrupt. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+      if (d->irq == f->vec_no && (inb (reg_isr (d)) & ISR_QUEUE))
+        finish_used (d);
+    }
+}
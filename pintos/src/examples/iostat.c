@@ -0,0 +1,60 @@
+/* iostat.c
+
+   Prints the request statistics of each block device that has
+   completed any requests: how many, how long they took, how many
+   were in flight, and how far the disk had to seek. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_histogram (const char *what,
+                             const unsigned long long hist[], int cnt);
+
+int
+main (void)
+{
+  struct block_stats s;
+  int n;
+
+  for (n = 0; block_stats (n, &s); n++)
+    {
+      unsigned long long requests = s.requests[0] + s.requests[1];
+      int i;
+
+      if (requests == 0)
+        continue;
+
+      printf ("%s: %llu sectors read, %llu written\n",
+              s.name, s.sectors[0], s.sectors[1]);
+      for (i = 0; i < 2; i++)
+        if (s.requests[i] != 0)
+          {
+            printf ("  %llu %s requests, %llu us average latency\n",
+                    s.requests[i], i == 0 ? "read" : "write",
+                    s.latency_us[i] / s.requests[i]);
+            print_histogram (i == 0 ? "read latency (us)"
+                             : "write latency (us)",
+                             s.latency_hist[i], BLOCK_LATENCY_BUCKETS);
+          }
+      printf ("  %llu average depth, %u in flight, %u at most\n",
+              s.depth_sum / requests, s.in_flight, s.max_in_flight);
+      printf ("  %llu seeks in %llu transfers\n", s.seeks, s.dispatches);
+      if (s.seeks != 0)
+        print_histogram ("seek distance (sectors)", s.seek_hist,
+                         BLOCK_SEEK_BUCKETS);
+    }
+  return EXIT_SUCCESS;
+}
+
+/* Prints the non-empty buckets of HIST, which has CNT buckets,
+   one per line. */
+static void
+print_histogram (const char *what, const unsigned long long hist[], int cnt)
+{
+  int i;
+
+  printf ("  %s:\n", what);
+  for (i = 0; i < cnt; i++)
+    if (hist[i] != 0)
+      printf ("    %10llu+ %llu\n", i == 0 ? 0ULL : 1ULL << i, hist[i]);
+}
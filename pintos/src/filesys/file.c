@@ -1,16 +1,32 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in bytes.  The window starts at the
+   minimum when a file is first read sequentially and doubles on
+   every further sequential read up to the maximum. */
+#define READ_AHEAD_MIN (4 * BLOCK_SECTOR_SIZE)
+#define READ_AHEAD_MAX (16 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    bool direct;                /* Bypass the buffer cache? */
+
+    /* Sequential read detection. */
+    off_t ra_next;              /* Offset a sequential reader reads next. */
+    off_t ra_window;            /* Read-ahead window, 0 if not sequential. */
+    off_t ra_end;               /* End of the range already read ahead. */
   };
 
+static void file_update_read_ahead (struct file *, off_t ofs,
+                                    off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +39,10 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->direct = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
+      file->ra_end = 0;
       return file;
     }
   else
@@ -53,6 +73,16 @@ file_close (struct file *file)
     }
 }
 
+/* Sets whether FILE moves whole sectors straight between the
+   caller's buffer and the disk, bypassing the buffer cache.
+   Worth it for large, sector-aligned transfers that would only
+   push everything else out of the cache. */
+void
+file_set_direct (struct file *file, bool direct)
+{
+  file->direct = direct;
+}
+
 /* Returns the inode encapsulated by FILE. */
 struct inode *
 file_get_inode (struct file *file)
@@ -68,7 +98,7 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = file_read_at (file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,7 +111,50 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read;
+
+  if (file->direct)
+    return inode_read_at_direct (file->inode, buffer, size, file_ofs);
+  bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_update_read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Notes that BYTES_READ bytes were just read from FILE at OFS.
+   A read that starts where the previous one ended grows FILE's
+   read-ahead window and queues whatever part of the window has
+   not been read ahead yet; any other read resets the window. */
+static void
+file_update_read_ahead (struct file *file, off_t ofs, off_t bytes_read)
+{
+  off_t start, target;
+
+  if (bytes_read <= 0)
+    return;
+
+  if (ofs == file->ra_next)
+    {
+      if (file->ra_window == 0)
+        file->ra_window = READ_AHEAD_MIN;
+      else if (file->ra_window < READ_AHEAD_MAX)
+        file->ra_window *= 2;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = ofs + bytes_read;
+
+  if (file->ra_window == 0)
+    return;
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  target = file->ra_next + file->ra_window;
+  if (target > start)
+    {
+      inode_read_ahead (file->inode, start, target - start);
+      file->ra_end = target;
+    }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -94,7 +167,7 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written = file_write_at (file, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -110,9 +183,22 @@ off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs)
 {
+  if (file->direct)
+    return inode_write_at_direct (file->inode, buffer, size, file_ofs);
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Allocates disk space for the first LENGTH bytes of FILE, as
+   contiguously as possible, without changing its length, so
+   that writes up to LENGTH never run out of space or fragment
+   the file.  Returns false if the disk is full or the file
+   system can't reserve space for FILE. */
+bool
+file_reserve (struct file *file, off_t length)
+{
+  return inode_reserve (file->inode, length);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -1,6 +1,7 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
@@ -10,6 +11,7 @@ struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
+void file_set_direct (struct file *, bool);
 
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
@@ -26,4 +28,7 @@ void file_seek (struct file *, off_t);
 off_t file_tell (struct file *);
 off_t file_length (struct file *);
 
+/* Disk space. */
+bool file_reserve (struct file *, off_t length);
+
 #endif /* filesys/file.h */
@@ -45,10 +45,13 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  flush_block_cache(true);
+  inode_done ();
+  /* The free map goes through the buffer cache, so it must be
+     written before the cache is torn down. */
   lock_acquire(&free_map_lock);
   free_map_close ();
-  lock_release(&free_map_lock); //TODO: NOT SURE IF NECESSARY
+  lock_release(&free_map_lock);
+  flush_block_cache(true);
 }
 
 
@@ -132,9 +135,11 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
     success = success && dir_create(inode_sector, 1)
                       && dir_add (parent, last_name, inode_sector);
 
-    if (!success && inode_sector != 0) {
+    if (inode_sector != 0) {
       lock_acquire(&free_map_lock);
-      free_map_release (inode_sector, 1);
+      if (!success)
+        free_map_release (inode_sector, 1);
+      free_map_flush();
       lock_release(&free_map_lock);
     }
 
@@ -153,9 +158,11 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
       success = success && inode_create (inode_sector, initial_size, false)
                         && dir_add (parent, last_name, inode_sector);
 
-    if (!success && inode_sector != 0) {
+    if (inode_sector != 0) {
       lock_acquire(&free_map_lock);
-      free_map_release (inode_sector, 1);
+      if (!success)
+        free_map_release (inode_sector, 1);
+      free_map_flush();
       lock_release(&free_map_lock);
     }
 
@@ -172,7 +179,7 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
 struct file *
 filesys_open (const char *name)
 {
-  int fd = open_helper(name);
+  int fd = open_helper(name, 0);
   if (fd == -1) {return NULL;}
 
 
@@ -1,6 +1,7 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include <threads/synch.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -9,6 +10,24 @@
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that are behind FREE_MAP, one bit
+   per sector.  Allocating and releasing only change FREE_MAP;
+   free_map_flush() writes these out. */
+static struct bitmap *free_map_dirty;
+
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Notes that bits START through START + CNT - 1 of the free map
+   changed. */
+static void
+mark_dirty (size_t start, size_t cnt)
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void)
@@ -18,6 +37,14 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  /* Optional: without the index, scans just take linear time.
+     All changes to the free map are made under free_map_lock, as
+     the index requires. */
+  bitmap_build_index (free_map);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
   num_free = block_size(fs_device);
@@ -27,22 +54,16 @@ free_map_init (void)
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+   The free map file is not written until free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
   ASSERT(lock_held_by_current_thread(&free_map_lock))
 
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector = bitmap_scan_and_flip_next (free_map, cnt, false);
   if (sector != BITMAP_ERROR) {
+    mark_dirty (sector, cnt);
     *sectorp = sector;
     num_free -= cnt;
   }
@@ -50,12 +71,54 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to WANT consecutive sectors near GOAL and stores
+   the first into *SECTORP.  Takes the first run of all WANT at or
+   after GOAL, wrapping around to the start of the disk, or if
+   there is none, the first free sector at or after GOAL and as
+   many free ones as follow it.  Returns the number of sectors
+   allocated, 0 if the disk is full.
+   The free map file is not written until free_map_flush(). */
+size_t
+free_map_allocate_near (size_t want, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector, cnt = want;
+
+  ASSERT(lock_held_by_current_thread(&free_map_lock))
+  ASSERT (want > 0);
+
+  if (goal >= size)
+    goal = 0;
+  sector = bitmap_scan (free_map, goal, want, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, want, false);
+  if (sector == BITMAP_ERROR)
+    {
+      sector = bitmap_scan (free_map, goal, 1, false);
+      if (sector == BITMAP_ERROR)
+        sector = bitmap_scan (free_map, 0, 1, false);
+      if (sector == BITMAP_ERROR)
+        return 0;
+      for (cnt = 1; cnt < want && sector + cnt < size; cnt++)
+        if (bitmap_test (free_map, sector + cnt))
+          break;
+    }
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  num_free -= cnt;
+  *sectorp = sector;
+  return cnt;
+}
+
 uint32_t
 free_map_num_free(void) {
   return num_free;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+   The free map file is not written until free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
@@ -64,11 +127,44 @@ free_map_release (block_sector_t sector, size_t cnt)
 
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
   num_free += cnt;
 
 }
 
+/* Writes the sectors of the free map file that changed since the
+   last flush, each run of consecutive ones with one write.  Call
+   it once an operation's allocations and releases are done,
+   rather than after each one.
+   Returns false if the free map file could not be written. */
+bool
+free_map_flush (void)
+{
+  size_t sector;
+
+  ASSERT(lock_held_by_current_thread(&free_map_lock))
+
+  if (free_map_file == NULL)
+    return true;
+  for (sector = bitmap_scan (free_map_dirty, 0, 1, true);
+       sector != BITMAP_ERROR;
+       sector = bitmap_scan (free_map_dirty, sector, 1, true))
+    {
+      size_t cnt = 1;
+
+      while (sector + cnt < bitmap_size (free_map_dirty)
+             && bitmap_test (free_map_dirty, sector + cnt))
+        cnt++;
+      if (!bitmap_write_partial (free_map, free_map_file,
+                                 sector * BLOCK_SECTOR_SIZE,
+                                 cnt * BLOCK_SECTOR_SIZE))
+        return false;
+      bitmap_set_multiple (free_map_dirty, sector, cnt, false);
+      sector += cnt;
+    }
+  return true;
+}
+
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void)
@@ -87,7 +183,10 @@ free_map_open (void)
 void
 free_map_close (void)
 {
+  if (!free_map_flush ())
+    PANIC ("can't write free map");
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -100,11 +199,16 @@ free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The new file is a hole, so writing it
+     allocates its sectors, which the write then records; it is
+     not the free map file until then, so that the allocation
+     doesn't try to flush the free map into it. */
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
+  bitmap_set_all (free_map_dirty, false);
 
 }
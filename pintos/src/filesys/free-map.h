@@ -14,7 +14,9 @@ void free_map_close (void);
 uint32_t free_map_num_free(void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+bool free_map_flush (void);
 
 struct lock  free_map_lock;   /* Free map lock */
 uint32_t num_free;            /* Free map number free */
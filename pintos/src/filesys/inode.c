@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -7,13 +8,51 @@
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
-
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/pagedir.h"
+#endif
+
+/* Identifies an inode.  The magic number also selects the
+   layout of its block map. */
+#define INODE_MAGIC 0x494e4f44          /* "INOD": direct and doubly indirect pointers. */
+#define INODE_MAGIC_EXTENT 0x494e4f45   /* "INOE": extent tree. */
+#define INODE_MAGIC_INLINE 0x494e4f49   /* "INOI": data inside the inode. */
 
 #define NUM_DIRECT_BLOCKS 124
 #define NUM_BLOCKS_IN_IND 128
 
+#define INODE_EXTENTS 41             /* Extents in the root node, inside the inode. */
+#define NODE_EXTENTS 42              /* Extents in an extent tree node sector. */
+#define INODE_INLINE_MAX 500         /* Bytes of data an INODE_MAGIC_INLINE inode holds. */
+
+#define MAX_READ_AHEAD_REQUESTS 32   /* Queued read-ahead requests beyond this are dropped. */
+#define MAX_CLOSED_INODES 64         /* Closed inodes kept around for inode_open(). */
+#define XLATE_RUNS 4                 /* Translations cached per open inode. */
+#define DIRECT_MAX_SECTORS 64        /* Sectors per direct I/O device request. */
+#define PREALLOC_MIN 8               /* First preallocation window of an appending file, in sectors. */
+#define PREALLOC_MAX 128             /* Largest preallocation window. */
+
+
+/* A run of file blocks.  In a leaf node it maps CNT blocks
+   starting at file block BLOCK to as many consecutive sectors
+   starting at START.  In an interior node START is the child
+   node's sector, which maps file blocks from BLOCK up to the
+   next entry's BLOCK, and CNT is unused. */
+struct extent
+  {
+    uint32_t block;                     /* First file block. */
+    block_sector_t start;               /* First sector, or child node. */
+    uint32_t cnt;                       /* Number of blocks. */
+  };
+
+/* Header of an extent tree node. */
+struct extent_header
+  {
+    uint16_t cnt;                       /* Number of entries in use. */
+    uint16_t depth;                     /* 0 for a leaf. */
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
@@ -22,18 +61,46 @@ struct inode_disk
     off_t length;
     unsigned magic;
     uint32_t is_dir; //0 is not directory, anything else is directory
-    block_sector_t direct_ptrs[NUM_DIRECT_BLOCKS];
-    block_sector_t doubly_indirect_ptr;
-
+    union
+      {
+        /* INODE_MAGIC. */
+        struct
+          {
+            block_sector_t direct_ptrs[NUM_DIRECT_BLOCKS];
+            block_sector_t doubly_indirect_ptr;
+          };
+
+        /* INODE_MAGIC_EXTENT: root node of the extent tree, with
+           entries sorted by BLOCK. */
+        struct
+          {
+            struct extent_header root_hdr;
+            struct extent root[INODE_EXTENTS];
+            uint32_t unused;
+          };
+
+        /* INODE_MAGIC_INLINE: the file's bytes, zeros past
+           LENGTH. */
+        uint8_t inline_data[INODE_INLINE_MAX];
+      };
   };
 
 struct indirect_disk_block {
   block_sector_t blocks[128];
 };
 
+/* Extent tree node other than the root.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_node
+  {
+    struct extent_header hdr;
+    struct extent e[NODE_EXTENTS];
+    uint32_t unused;
+  };
+
 
-bool inode_block_allocate(struct inode *inode, off_t end_pos);
-bool inode_block_alloc_helper(struct inode_disk *id, off_t end_len);
+bool inode_block_allocate(struct inode *inode, off_t start, off_t end_pos);
+bool inode_block_alloc_helper(struct inode_disk *id, block_sector_t sector, off_t end_len);
 uint32_t inode_is_dir (const struct inode *inode);
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -47,13 +114,25 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem elem;              /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct lock inode_lock;
+    struct lock inode_lock;             /* Serializes changes to DATA. */
     int isdir;
+    struct inode_disk data;             /* Resident copy of the on-disk inode. */
+    struct lock xlate_lock;             /* Protects XLATE and XLATE_NEXT. */
+    struct extent xlate[XLATE_RUNS];    /* Recently translated runs, CNT 0 if unused. */
+    int xlate_next;                     /* Entry of XLATE to replace next. */
+
+    /* Sectors taken from the free map for this inode's next
+       appends but not mapped yet, under inode_lock.  Given back
+       when the last opener closes it. */
+    block_sector_t prealloc_start;      /* First reserved sector. */
+    block_sector_t prealloc_cnt;        /* Number of reserved sectors. */
+    block_sector_t prealloc_window;     /* Size of the last reservation. */
   };
 
   int inode_get_isdir(const struct inode *inode) {
@@ -65,78 +144,656 @@ struct inode
   }
 
 
-static struct inode_disk*
-inode_get_data(const struct inode *inode) {
-  struct inode_disk *id = malloc(sizeof(struct inode_disk));
-  block_cache_read (fs_device, inode->sector, id);
-  return id;
+/* Whether SECTOR can be a block pointer of a file. Sector 0 holds the free map inode, so it means "none" */
+static bool
+is_data_sector(block_sector_t sector) {
+  return sector != 0 && sector < block_size(fs_device);
+}
+
+/* Sets *RUN, if non-null, to the run of consecutive sectors
+   that starts with PTRS[I], which maps file block BLOCK, and
+   continues through the first CNT entries of PTRS. */
+static void
+pointer_run(const block_sector_t *ptrs, int cnt, int i, uint32_t block, struct extent *run) {
+  int n = 1;
+
+  if (run == NULL)
+    return;
+  while (i + n < cnt && ptrs[i + n] == ptrs[i] + n)
+    n++;
+  run->block = block;
+  run->start = ptrs[i];
+  run->cnt = n;
 }
 
+/* Translates BLOCK_NUM through the direct and doubly indirect
+   pointers of an INODE_MAGIC inode.  If RUN is non-null, also
+   sets it to the run of sectors from there to the end of the
+   direct pointers or the indirect block that holds them. */
 static block_sector_t
-block_num_to_sector(struct inode_disk *id, int block_num) {
+pointer_block_to_sector(const struct inode_disk *id, int block_num, struct extent *run) {
   uint32_t answer;
-  struct indirect_disk_block data;
+  struct indirect_disk_block *data;
 
   if (block_num < NUM_DIRECT_BLOCKS) {
     answer = id->direct_ptrs[block_num];
+    pointer_run(id->direct_ptrs, NUM_DIRECT_BLOCKS, block_num, block_num, run);
   } else {
-    if (id->doubly_indirect_ptr == NULL) {
+    if (!is_data_sector(id->doubly_indirect_ptr)) {
       return (block_sector_t) -1; //no doubly indirect
     }
-    // read in doubly indirect block pointers
-    block_cache_read(fs_device, id->doubly_indirect_ptr, &data);
+    if (block_num - NUM_DIRECT_BLOCKS >= NUM_BLOCKS_IN_IND * NUM_BLOCKS_IN_IND) {
+      return (block_sector_t) -1; //past the largest possible file
+    }
+    // look at doubly indirect block pointers in place
+    data = block_cache_get(fs_device, id->doubly_indirect_ptr, BLOCK_CACHE_READ);
 
     int indirect_block_num = (block_num - NUM_DIRECT_BLOCKS) / NUM_BLOCKS_IN_IND;
     int indirect_block_ind = (block_num - NUM_DIRECT_BLOCKS) % NUM_BLOCKS_IN_IND;
+    block_sector_t indirect_sector = data->blocks[indirect_block_num];
+    block_cache_put(data);
 
-
-    if (data.blocks[indirect_block_num] == NULL) {
+    if (!is_data_sector(indirect_sector)) {
       return (block_sector_t) -1; //no indirect inside of doubly indirect
     }
 
-    // read in correct singly indirect block
-    block_cache_read(fs_device, data.blocks[indirect_block_num], &data);
+    // look at correct singly indirect block
+    data = block_cache_get(fs_device, indirect_sector, BLOCK_CACHE_READ);
 
     // get index of sector to read
-    answer = data.blocks[indirect_block_ind];
+    answer = data->blocks[indirect_block_ind];
+    pointer_run(data->blocks, NUM_BLOCKS_IN_IND, indirect_block_ind, block_num, run);
+    block_cache_put(data);
 
   }
 
   return answer;
 }
 
+/* Returns the index of the last of the CNT entries in E whose
+   BLOCK is at most BLOCK, or -1 if there is none. */
+static int
+extent_find (const struct extent *e, int cnt, uint32_t block)
+{
+  int lo = 0, hi = cnt;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (e[mid].block <= block)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo - 1;
+}
+
+/* Translates BLOCK through the extent tree of ID, and sets *RUN,
+   if non-null, to the extent that maps it.  Each level below the
+   root costs one cached sector read, and files laid out in fewer
+   than INODE_EXTENTS runs need none. */
+static block_sector_t
+extent_block_to_sector (const struct inode_disk *id, uint32_t block,
+                        struct extent *run)
+{
+  const struct extent_header *hdr = &id->root_hdr;
+  const struct extent *e = id->root;
+  struct extent_node *node = NULL;
+  block_sector_t answer = (block_sector_t) -1;
+
+  for (;;)
+    {
+      int i = extent_find (e, hdr->cnt, block);
+      if (i < 0)
+        break;
+      if (hdr->depth == 0)
+        {
+          if (block - e[i].block < e[i].cnt)
+            {
+              answer = e[i].start + (block - e[i].block);
+              if (run != NULL)
+                *run = e[i];
+            }
+          break;
+        }
+      /* E may point into NODE, so read the child's sector before
+         unpinning it. */
+      block_sector_t child = e[i].start;
+      if (node != NULL)
+        block_cache_put (node);
+      node = block_cache_get (fs_device, child, BLOCK_CACHE_READ);
+      hdr = &node->hdr;
+      e = node->e;
+    }
+  if (node != NULL)
+    block_cache_put (node);
+  return answer;
+}
+
+/* Returns the sector that holds block BLOCK_NUM of the file
+   with inode ID, or -1 if there is none.  If RUN is non-null and
+   there is one, also sets *RUN to a run of blocks around it that
+   lie in consecutive sectors. */
+static block_sector_t
+block_num_to_sector(const struct inode_disk *id, int block_num, struct extent *run) {
+  if (id->magic == INODE_MAGIC_INLINE)
+    return (block_sector_t) -1; //no blocks at all
+  if (id->magic == INODE_MAGIC_EXTENT)
+    return extent_block_to_sector(id, block_num, run);
+  return pointer_block_to_sector(id, block_num, run);
+}
+
+/* Inserts X as entry P of the node with header HDR and entries
+   E, which has room for MAX.  If the node is full, first moves
+   its upper half to a newly allocated node, and sets *SPLIT to
+   the index entry for that node, which the caller must add to
+   the parent.  Returns false if no sector was free for the new
+   node, without changing anything.  Needs free_map_lock. */
+static bool
+extent_node_add (struct extent_header *hdr, struct extent *e, int max, int p,
+                 const struct extent *x, struct extent *split, bool *did_split)
+{
+  *did_split = false;
+  if (hdr->cnt == max)
+    {
+      struct extent_node sibling;
+      block_sector_t sector;
+      int half = max / 2;
+
+      if (!free_map_allocate (1, &sector))
+        return false;
+      memset (&sibling, 0, sizeof sibling);
+      sibling.hdr.depth = hdr->depth;
+      sibling.hdr.cnt = max - half;
+      memcpy (sibling.e, e + half, (max - half) * sizeof *e);
+      hdr->cnt = half;
+      if (p > half)
+        extent_node_add (&sibling.hdr, sibling.e, NODE_EXTENTS, p - half,
+                         x, NULL, did_split);
+      block_cache_write (fs_device, sector, &sibling);
+
+      split->block = sibling.e[0].block;
+      split->start = sector;
+      split->cnt = 0;
+      *did_split = true;
+      if (p > half)
+        return true;
+    }
+  memmove (e + p + 1, e + p, (hdr->cnt - p) * sizeof *e);
+  e[p] = *x;
+  hdr->cnt++;
+  return true;
+}
+
+/* Maps extent X into the subtree whose root has header HDR and
+   entries E, with room for MAX, merging it into the extent it
+   follows if the sectors line up.  On a split, sets *DID_SPLIT
+   and *SPLIT as extent_node_add() does. */
+static bool
+extent_subtree_add (struct extent_header *hdr, struct extent *e, int max,
+                    const struct extent *x, struct extent *split,
+                    bool *did_split)
+{
+  int i = extent_find (e, hdr->cnt, x->block);
+  struct extent_node *child;
+  struct extent child_split;
+  bool child_did_split;
+  bool success;
+
+  *did_split = false;
+  if (hdr->depth == 0)
+    {
+      if (i >= 0 && e[i].block + e[i].cnt == x->block
+          && e[i].start + e[i].cnt == x->start)
+        {
+          e[i].cnt += x->cnt;
+          return true;
+        }
+      return extent_node_add (hdr, e, max, i + 1, x, split, did_split);
+    }
+
+  if (i < 0)
+    {
+      /* X comes before everything; widen the first child. */
+      i = 0;
+      e[0].block = x->block;
+    }
+  child = block_cache_get (fs_device, e[i].start, BLOCK_CACHE_WRITE);
+  success = extent_subtree_add (&child->hdr, child->e, NODE_EXTENTS, x,
+                                &child_split, &child_did_split);
+  block_cache_put (child);
+  if (!success || !child_did_split)
+    return success;
+  return extent_node_add (hdr, e, max, i + 1, &child_split, split, did_split);
+}
+
+/* Maps CNT blocks of ID starting at file block BLOCK to the
+   sectors starting at START.  Returns false if the tree needed a
+   new node and the disk is full, in which case ID is unchanged.
+   Needs free_map_lock. */
+static bool
+extent_add (struct inode_disk *id, uint32_t block, block_sector_t start,
+            uint32_t cnt)
+{
+  struct extent x, split;
+  bool did_split;
+
+  /* One new node per level, plus one to grow the tree, is the
+     most an insertion can take.  Checking first means a split
+     never fails halfway up. */
+  if (free_map_num_free () < id->root_hdr.depth + 2u)
+    return false;
+
+  x.block = block;
+  x.start = start;
+  x.cnt = cnt;
+  if (!extent_subtree_add (&id->root_hdr, id->root, INODE_EXTENTS, &x,
+                           &split, &did_split))
+    return false;
+  if (did_split)
+    {
+      /* The root split.  Move what is left of it into a node of
+         its own, and make the root the parent of the two. */
+      struct extent_node left;
+      block_sector_t sector;
+
+      free_map_allocate (1, &sector);
+      memset (&left, 0, sizeof left);
+      left.hdr = id->root_hdr;
+      memcpy (left.e, id->root, id->root_hdr.cnt * sizeof *id->root);
+      block_cache_write (fs_device, sector, &left);
+
+      id->root[0].block = left.e[0].block;
+      id->root[0].start = sector;
+      id->root[0].cnt = 0;
+      id->root[1] = split;
+      id->root_hdr.cnt = 2;
+      id->root_hdr.depth++;
+    }
+  return true;
+}
+
+/* Releases the sectors mapped by the subtree with header HDR and
+   entries E, and its nodes below the root.  Needs free_map_lock. */
+static void
+extent_subtree_release (const struct extent_header *hdr,
+                        const struct extent *e)
+{
+  int i;
+
+  for (i = 0; i < hdr->cnt; i++)
+    if (hdr->depth == 0)
+      free_map_release (e[i].start, e[i].cnt);
+    else
+      {
+        struct extent_node *child = block_cache_get (fs_device, e[i].start,
+                                                     BLOCK_CACHE_READ);
+        extent_subtree_release (&child->hdr, child->e);
+        block_cache_put (child);
+        free_map_release (e[i].start, 1);
+      }
+}
+
+/* Releases the data, indirect and doubly indirect sectors of an
+   INODE_MAGIC inode.  Needs free_map_lock. */
+static void
+pointer_release(const struct inode_disk *data)
+{
+  size_t sectors = bytes_to_sectors (data->length);
+  size_t curr_block = 0;
+  struct indirect_disk_block doubly_indirect_block;
+  bool doubly_indirect_obtained = false;
+
+  struct indirect_disk_block indirect_block;
+  int number_for_current_indirect_block = -1;
+
+  while (curr_block < sectors) {
+    int indirect_offset = (curr_block - NUM_DIRECT_BLOCKS) % NUM_BLOCKS_IN_IND;
+    int indirect_number = (curr_block - NUM_DIRECT_BLOCKS) / NUM_BLOCKS_IN_IND;
+
+
+    //dealloc direct blocks
+    if (curr_block < NUM_DIRECT_BLOCKS) {
+      free_map_release(data->direct_ptrs[curr_block], 1);
+      curr_block ++;
+      continue; //used to prevent creation of doubly indirect on this go
+    }
+
+    //fetch doubly indirect
+    if (!doubly_indirect_obtained) {
+      block_cache_read(fs_device, data->doubly_indirect_ptr, &doubly_indirect_block);
+      doubly_indirect_obtained = true;
+    }
+
+    // free indirect block behind us
+    if (indirect_offset == 0 && number_for_current_indirect_block != -1) {
+      // allocate indirect block
+      free_map_release(doubly_indirect_block.blocks[number_for_current_indirect_block], 1);
+    }
+    // fetch current indirect block
+    if (number_for_current_indirect_block != indirect_number) {
+      block_cache_read(fs_device, doubly_indirect_block.blocks[indirect_number], &indirect_block);
+      number_for_current_indirect_block = indirect_number;
+    }
+    // free data block
+    free_map_release(indirect_block.blocks[indirect_offset], 1);
+    curr_block ++;
+  }
+  //free currently held indirect block
+  if (number_for_current_indirect_block != -1) {
+    free_map_release(doubly_indirect_block.blocks[number_for_current_indirect_block], 1);
+  }
+
+  if (doubly_indirect_obtained) {
+    free_map_release(data->doubly_indirect_ptr, 1);
+
+  }
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.
+   Each translation caches the run of consecutive sectors around
+   it, so sequential and strided access only goes back to the
+   indirect blocks or extent tree when it leaves a run.  Writers
+   change the block map of the resident inode in place, under
+   inode_lock, so walking it takes that lock too. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
 
   int block_number = pos / BLOCK_SECTOR_SIZE; //TODO: CHECK FOR CORRECTNESS OF THIS FORMULA
-  struct inode_disk *id = inode_get_data(inode);
 
-  block_sector_t answer = block_num_to_sector(id, block_number);
-  free(id);
+  struct extent run;
+  block_sector_t answer;
+  int i;
+
+  /* The translation cache is shared by every thread reading or
+     writing INODE, which don't all hold inode_lock, so it has a
+     lock of its own.  It is never held across I/O. */
+  lock_acquire (&inode->xlate_lock);
+  for (i = 0; i < XLATE_RUNS; i++) {
+    const struct extent *x = &inode->xlate[i];
+    if ((uint32_t) block_number - x->block < x->cnt) {
+      answer = x->start + (block_number - x->block);
+      lock_release (&inode->xlate_lock);
+      return answer;
+    }
+  }
+  lock_release (&inode->xlate_lock);
+
+  /* Caching the run before inode_lock is released keeps it from
+     outliving an xlate_invalidate(). */
+  lock_acquire (&inode->inode_lock);
+  answer = block_num_to_sector(&inode->data, block_number, &run);
+  if (is_data_sector(answer)) {
+    lock_acquire (&inode->xlate_lock);
+    inode->xlate[inode->xlate_next] = run;
+    inode->xlate_next = (inode->xlate_next + 1) % XLATE_RUNS;
+    lock_release (&inode->xlate_lock);
+  }
+  lock_release (&inode->inode_lock);
   return answer;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Forgets INODE's cached translations.  Called, under
+   inode_lock, whenever INODE's block map changes. */
+static void
+xlate_invalidate (struct inode *inode)
+{
+  lock_acquire (&inode->xlate_lock);
+  memset (inode->xlate, 0, sizeof inode->xlate);
+  inode->xlate_next = 0;
+  lock_release (&inode->xlate_lock);
+}
+
+/* Open inodes and recently closed ones, indexed by sector, so
+   that opening a single inode twice returns the same `struct
+   inode'. */
+static struct hash open_inodes;
+
+/* Inodes in open_inodes whose open_cnt has dropped to 0, least
+   recently closed first.  Reopening one takes it off this list
+   without reading the disk; past MAX_CLOSED_INODES the oldest is
+   freed. */
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/* Number of inodes ever taken out of open_inodes, so that
+   inode_open() can tell whether the sector it read without
+   open_inodes_lock might be older than an inode dropped
+   meanwhile. */
+static unsigned open_inodes_removals;
+
+/* Protects open_inodes, closed_inodes, open_inodes_removals and
+   open_cnt. */
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, hash_elem);
+  const struct inode *b = hash_entry (b_, struct inode, hash_elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the inode in open_inodes for SECTOR, or a null pointer
+   if there is none.  Needs open_inodes_lock. */
+static struct inode *
+lookup_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/* Frees the least recently closed inode.  Needs open_inodes_lock. */
+static void
+evict_closed_inode (void)
+{
+  struct inode *inode = list_entry (list_pop_front (&closed_inodes),
+                                    struct inode, elem);
+  closed_inode_cnt--;
+  hash_delete (&open_inodes, &inode->hash_elem);
+  open_inodes_removals++;
+  free (inode);
+}
+
+/* A range of a file queued for read-ahead.  It names the inode
+   by sector instead of holding a `struct inode', so the worker
+   never races with inode_close(); a stale request just fails the
+   magic check or prefetches sectors nobody asks for. */
+struct read_ahead
+  {
+    struct list_elem elem;              /* Element in read_ahead_queue. */
+    struct inode *inode;                /* The file, reopened for the request. */
+    off_t start;                        /* First byte to prefetch. */
+    off_t end;                          /* One past the last byte. */
+  };
+
+static struct list read_ahead_queue;    /* Pending read_ahead requests. */
+static size_t read_ahead_cnt;           /* Number of requests in read_ahead_queue. */
+static struct lock read_ahead_lock;     /* Protects the two above. */
+static struct semaphore read_ahead_sema; /* Up'd once per queued request, and to stop. */
+static struct semaphore read_ahead_done; /* Up'd by the worker when it exits. */
+static bool read_ahead_stop;            /* Asks the worker to exit. */
+
+static void read_ahead_worker (void *aux);
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_inode_cnt = 0;
+  lock_init (&open_inodes_lock);
+
+  list_init (&read_ahead_queue);
+  read_ahead_cnt = 0;
+  lock_init (&read_ahead_lock);
+  sema_init (&read_ahead_sema, 0);
+  sema_init (&read_ahead_done, 0);
+  read_ahead_stop = false;
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_worker, NULL);
+}
+
+/* Shuts down the inode module.  Stops the read-ahead worker so
+   that the buffer cache can be torn down underneath it. */
+void
+inode_done (void)
+{
+  read_ahead_stop = true;
+  sema_up (&read_ahead_sema);
+  sema_down (&read_ahead_done);
+
+  /* Closed inodes were written through when they changed, so
+     there is nothing to save. */
+  lock_acquire (&open_inodes_lock);
+  while (closed_inode_cnt > 0)
+    evict_closed_inode ();
+  lock_release (&open_inodes_lock);
+}
+
+/* Asks the read-ahead worker to bring LENGTH bytes of INODE
+   starting at START into the buffer cache, along with the
+   indirect blocks needed to find them.  Returns without waiting
+   for any I/O. */
+void
+inode_read_ahead (struct inode *inode, off_t start, off_t length)
+{
+  struct read_ahead *ra;
+
+  if (length <= 0 || read_ahead_cnt >= MAX_READ_AHEAD_REQUESTS)
+    return;
+  ra = malloc (sizeof *ra);
+  if (ra == NULL)
+    return;
+  ra->inode = inode_reopen (inode);
+  ra->start = start;
+  ra->end = start + length;
+
+  lock_acquire (&read_ahead_lock);
+  list_push_back (&read_ahead_queue, &ra->elem);
+  read_ahead_cnt++;
+  lock_release (&read_ahead_lock);
+  sema_up (&read_ahead_sema);
+}
+
+/* Prefetches the data sectors of RA that lie within the file,
+   each run of contiguous sectors with one request. */
+static void
+read_ahead_range (const struct read_ahead *ra)
+{
+  off_t length = inode_length (ra->inode);
+  off_t end;
+  int block_num;
+  block_sector_t run_start = 0;
+  block_sector_t run_cnt = 0;
+
+  /* This walks the resident inode, which RA holds open, so a
+     removed file's sectors can't be reused under it.  Through
+     byte_to_sector() the indirect blocks end up cached as well. */
+  end = ra->end < length ? ra->end : length;
+  for (block_num = ra->start / BLOCK_SECTOR_SIZE;
+       block_num * BLOCK_SECTOR_SIZE < end; block_num++)
+    {
+      block_sector_t sector = byte_to_sector (ra->inode,
+                                              block_num * BLOCK_SECTOR_SIZE);
+      if (!is_data_sector (sector))
+        continue;               /* A hole: nothing to read. */
+      if (run_cnt > 0 && sector == run_start + run_cnt)
+        {
+          run_cnt++;
+          continue;
+        }
+      block_cache_prefetch_range (fs_device, run_start, run_cnt);
+      run_start = sector;
+      run_cnt = 1;
+    }
+  block_cache_prefetch_range (fs_device, run_start, run_cnt);
+}
+
+/* Brings LENGTH bytes of INODE starting at START into the buffer
+   cache before returning, for callers that are about to read all
+   of it, such as the program loader. */
+void
+inode_prefetch (struct inode *inode, off_t start, off_t length)
+{
+  struct read_ahead ra;
+
+  if (length <= 0)
+    return;
+  ra.inode = inode;
+  ra.start = start;
+  ra.end = start + length;
+  read_ahead_range (&ra);
+}
+
+/* Read-ahead thread, started by inode_init(). */
+static void
+read_ahead_worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct read_ahead *ra;
+
+      sema_down (&read_ahead_sema);
+      if (read_ahead_stop)
+        break;
+
+      lock_acquire (&read_ahead_lock);
+      ra = list_entry (list_pop_front (&read_ahead_queue),
+                       struct read_ahead, elem);
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      read_ahead_range (ra);
+      inode_close (ra->inode);
+      free (ra);
+    }
+
+  /* Drop the requests left over, closing their inodes. */
+  for (;;)
+    {
+      struct read_ahead *ra;
+
+      lock_acquire (&read_ahead_lock);
+      if (list_empty (&read_ahead_queue))
+        {
+          lock_release (&read_ahead_lock);
+          break;
+        }
+      ra = list_entry (list_pop_front (&read_ahead_queue),
+                       struct read_ahead, elem);
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      inode_close (ra->inode);
+      free (ra);
+    }
+  sema_up (&read_ahead_done);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data reads as zeros.  Up to INODE_INLINE_MAX
+   bytes of it live in the inode itself; longer data is one hole
+   whose blocks get sectors only once they are written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
@@ -152,63 +809,96 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = 0;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->length = length;
+      disk_inode->magic = length <= INODE_INLINE_MAX
+                          ? INODE_MAGIC_INLINE : INODE_MAGIC_EXTENT;
       disk_inode->is_dir = (uint32_t) is_dir;
-
-      if (inode_block_alloc_helper(disk_inode, length)) {
-
-        block_cache_write (fs_device, sector, disk_inode);
-        if (sectors > 0)
-        {
-          static char zeros[BLOCK_SECTOR_SIZE];
-          size_t i;
-
-          for (i = 0; i < sectors; i += 1)
-            block_cache_write (fs_device, block_num_to_sector(disk_inode, i) , zeros);
-        }
-        success = true;
-      }
-
+      block_cache_write (fs_device, sector, disk_inode);
+      success = true;
       free (disk_inode);
     }
   return success;
 }
 
+/* Returns the inode for SECTOR in open_inodes, opened once
+   more, or a null pointer if there is none.  Needs
+   open_inodes_lock. */
+static struct inode *
+reopen_cached_inode (block_sector_t sector)
+{
+  struct inode *inode = lookup_inode (sector);
+
+  if (inode != NULL && inode->open_cnt++ == 0)
+    {
+      list_remove (&inode->elem);
+      closed_inode_cnt--;
+    }
+  return inode;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+   The sector is read with open_inodes_lock dropped, so that other
+   openers and closers don't wait for the disk.  If another
+   thread opened the same inode meanwhile, its copy wins. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *new = NULL;
+  unsigned removals;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  for (;;)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
+      /* Check whether this inode is already open or recently
+         closed. */
+      lock_acquire (&open_inodes_lock);
+      inode = reopen_cached_inode (sector);
+      removals = open_inodes_removals;
+      lock_release (&open_inodes_lock);
+      if (inode != NULL)
         {
-          inode_reopen (inode);
+          free (new);
           return inode;
         }
-    }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+      /* Allocate memory. */
+      if (new == NULL)
+        {
+          new = malloc (sizeof *new);
+          if (new == NULL)
+            return NULL;
+        }
+      block_cache_read (fs_device, sector, &new->data);
+
+      lock_acquire (&open_inodes_lock);
+      inode = reopen_cached_inode (sector);
+      if (inode == NULL && removals == open_inodes_removals)
+        break;
+      lock_release (&open_inodes_lock);
+      if (inode != NULL)
+        {
+          free (new);
+          return inode;
+        }
+      /* An inode left open_inodes while we read, possibly this
+         one after writing a newer copy of SECTOR: read again. */
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  inode = new;
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  lock_init (&inode->inode_lock);
+  lock_init (&inode->xlate_lock);
+  xlate_invalidate (inode);
+  inode->prealloc_cnt = 0;
+  inode->prealloc_window = 0;
   inode->isdir = inode_is_dir(inode);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -217,7 +907,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -228,6 +922,19 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Takes INODE's preallocated sectors away from it, storing the
+   first into *START and their number into *CNT, for its last
+   opener to give back to the free map. */
+static void
+prealloc_take (struct inode *inode, block_sector_t *start,
+               block_sector_t *cnt)
+{
+  *start = inode->prealloc_start;
+  *cnt = inode->prealloc_cnt;
+  inode->prealloc_cnt = 0;
+  inode->prealloc_window = 0;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -238,77 +945,59 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
-    {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
-        {
-
-          struct inode_disk *data = inode_get_data(inode);
-          lock_acquire(&free_map_lock);
-
-          free_map_release (inode->sector, 1);
-
-          size_t sectors = bytes_to_sectors (data->length);
-          size_t curr_block = 0;
-          struct indirect_disk_block doubly_indirect_block;
-          bool doubly_indirect_obtained = false;
-
-          struct indirect_disk_block indirect_block;
-          int number_for_current_indirect_block = -1;
+  block_sector_t prealloc_start, prealloc_cnt;
 
-          while (curr_block < sectors) {
-            int indirect_offset = (curr_block - NUM_DIRECT_BLOCKS) % NUM_BLOCKS_IN_IND;
-            int indirect_number = (curr_block - NUM_DIRECT_BLOCKS) / NUM_BLOCKS_IN_IND;
-
-
-            //dealloc direct blocks
-            if (curr_block < NUM_DIRECT_BLOCKS) {
-              free_map_release(data->direct_ptrs[curr_block], 1);
-              curr_block ++;
-              continue; //used to prevent creation of doubly indirect on this go
-            }
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
 
-            //fetch doubly indirect
-            if (!doubly_indirect_obtained) {
-              block_cache_read(fs_device, data->doubly_indirect_ptr, &doubly_indirect_block);
-              doubly_indirect_obtained = true;
-            }
+  /* The preallocation goes back to the free map once
+     open_inodes_lock is dropped, since filesys_done() closes the
+     free map file with free_map_lock held. */
+  prealloc_take (inode, &prealloc_start, &prealloc_cnt);
 
-            // free indirect block behind us
-            if (indirect_offset == 0 && number_for_current_indirect_block != -1) {
-              // allocate indirect block
-              free_map_release(doubly_indirect_block.blocks[number_for_current_indirect_block], 1);
-            }
-            // fetch current indirect block
-            if (number_for_current_indirect_block != indirect_number) {
-              block_cache_read(fs_device, doubly_indirect_block.blocks[indirect_number], &indirect_block);
-              number_for_current_indirect_block = indirect_number;
-            }
-            // free data block
-            free_map_release(indirect_block.blocks[indirect_offset], 1);
+  /* Keep the last opener's inode around for a later
+     inode_open() unless it was removed. */
+  if (!inode->removed)
+    {
+      list_push_back (&closed_inodes, &inode->elem);
+      if (++closed_inode_cnt > MAX_CLOSED_INODES)
+        evict_closed_inode ();
+      lock_release (&open_inodes_lock);
+      if (prealloc_cnt > 0)
+        {
+          lock_acquire (&free_map_lock);
+          free_map_release (prealloc_start, prealloc_cnt);
+          free_map_flush ();
+          lock_release (&free_map_lock);
+        }
+      return;
+    }
+  hash_delete (&open_inodes, &inode->hash_elem);
+  open_inodes_removals++;
+  lock_release (&open_inodes_lock);
 
-          }
-          //free currently held indirect block
-          if (number_for_current_indirect_block != -1) {
-            free_map_release(doubly_indirect_block.blocks[number_for_current_indirect_block], 1);
-          }
+  /* Nobody can reach INODE any more, so deallocate its blocks,
+     since it was removed. */
+  struct inode_disk *data = &inode->data;
+  lock_acquire(&free_map_lock);
 
-          if (doubly_indirect_obtained) {
-            free_map_release(data->doubly_indirect_ptr, 1);
+  free_map_release (inode->sector, 1);
+  if (prealloc_cnt > 0)
+    free_map_release (prealloc_start, prealloc_cnt);
 
-          }
+  if (data->magic == INODE_MAGIC_EXTENT)
+    extent_subtree_release (&data->root_hdr, data->root);
+  else if (data->magic == INODE_MAGIC)
+    pointer_release (data);
 
-          lock_release(&free_map_lock);
-          free(data);
-        }
+  free_map_flush();
+  lock_release(&free_map_lock);
 
-      free (inode);
-    }
+  free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -320,6 +1009,58 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+static bool inline_to_extent (struct inode *);
+
+/* Reads from INODE's inline data like inode_read_at().  Returns
+   the number of bytes read, or -1 if INODE's data is in blocks. */
+static off_t
+inline_read (struct inode *inode, uint8_t *buffer, off_t size, off_t offset)
+{
+  off_t n = -1;
+
+  lock_acquire (&inode->inode_lock);
+  if (inode->data.magic == INODE_MAGIC_INLINE)
+    {
+      n = inode->data.length - offset;
+      if (n > size)
+        n = size;
+      if (n < 0 || offset < 0)
+        n = 0;
+      memcpy (buffer, inode->data.inline_data + offset, n);
+    }
+  lock_release (&inode->inode_lock);
+  return n;
+}
+
+/* Writes to INODE's inline data like inode_write_at(), growing
+   it if need be, and writes the inode through.  A write that
+   would not fit moves the data out to a block first.  Returns
+   the number of bytes written, or -1 if INODE's data is, or now
+   is, in blocks. */
+static off_t
+inline_write (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset)
+{
+  off_t n = -1;
+
+  lock_acquire (&inode->inode_lock);
+  if (inode->data.magic == INODE_MAGIC_INLINE)
+    {
+      if (offset + size <= INODE_INLINE_MAX)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (inode->data.length < offset + size)
+            inode->data.length = offset + size;
+          block_cache_write (fs_device, inode->sector, &inode->data);
+          n = size;
+        }
+      else if (!inline_to_extent (inode))
+        n = 0;
+    }
+  lock_release (&inode->inode_lock);
+  return n;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -328,6 +1069,14 @@ inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset) {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
 
+  //an inode only ever stops being inline, so a miss here is final
+  if (inode->data.magic == INODE_MAGIC_INLINE) {
+    bytes_read = inline_read(inode, buffer, size, offset);
+    if (bytes_read >= 0)
+      return bytes_read;
+    bytes_read = 0;
+  }
+
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
@@ -343,8 +1092,10 @@ inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset) {
     if (chunk_size <= 0)
       break;
 
-
-    block_cache_read_offset(fs_device, sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+    if (is_data_sector(sector_idx))
+      block_cache_read_offset(fs_device, sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+    else
+      memset(buffer + bytes_read, 0, chunk_size); //a hole
 
     /* Advance. */
     size -= chunk_size;
@@ -375,9 +1126,16 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size,
   if (inode->deny_write_cnt)
     return 0;
 
+  if (inode->data.magic == INODE_MAGIC_INLINE) {
+    bytes_written = inline_write(inode, buffer, size, offset);
+    if (bytes_written >= 0)
+      return bytes_written;
+    bytes_written = 0;
+  }
+
   if (inode_length(inode) < offset + size) {
-    //need to allocate more
-    if (!inode_block_allocate(inode, offset + size)) {
+    //need to grow, mapping the blocks this write lands in
+    if (!inode_block_allocate(inode, offset, offset + size)) {
       return 0; //failed to allocate
     }
   }
@@ -397,6 +1155,15 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size,
     if (chunk_size <= 0)
       break;
 
+    if (!is_data_sector(sector_idx)) {
+      //a hole inside the file: map it and any others up to the end of the write
+      if (!inode_block_allocate(inode, offset, offset + size))
+        break;
+      sector_idx = byte_to_sector(inode, offset);
+      if (!is_data_sector(sector_idx))
+        break;
+    }
+
     block_cache_write_offset(fs_device, sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
 
     /* Advance. */
@@ -410,6 +1177,141 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size,
   return bytes_written;
 }
 
+/* Returns an address for the BLOCK_SECTOR_SIZE bytes at P that
+   a driver can reach from its interrupt handler and by DMA, which
+   a user address in the current process is not, or a null
+   pointer if there is none. */
+static void *
+direct_buffer (void *p)
+{
+  if (!is_user_vaddr (p))
+    return p;
+#ifdef USERPROG
+  /* A sector that straddles two user pages need not be
+     contiguous in physical memory. */
+  if (pg_ofs (p) + BLOCK_SECTOR_SIZE <= PGSIZE
+      && thread_current ()->pagedir != NULL)
+    return pagedir_get_page (thread_current ()->pagedir, p);
+#endif
+  return NULL;
+}
+
+/* Moves whole sectors of INODE between BUFFER and the device,
+   bypassing the buffer cache, starting at OFFSET, which must be
+   sector-aligned, for at most SIZE bytes and not past the end of
+   the file.  Physically consecutive sectors go in one request.
+   Stops early at a sector it can't move directly.  Returns the
+   number of bytes moved, a multiple of BLOCK_SECTOR_SIZE. */
+static off_t
+direct_transfer (struct inode *inode, uint8_t *buffer, off_t size,
+                 off_t offset, bool write)
+{
+  void *buffers[DIRECT_MAX_SECTORS];
+  off_t length = inode_length (inode);
+  off_t done = 0;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+  for (;;)
+    {
+      block_sector_t start = 0;
+      size_t cnt = 0;
+
+      while (cnt < DIRECT_MAX_SECTORS)
+        {
+          off_t ofs = done + (off_t) cnt * BLOCK_SECTOR_SIZE;
+          block_sector_t sector;
+          void *kbuf;
+
+          if (size - ofs < BLOCK_SECTOR_SIZE
+              || length - (offset + ofs) < BLOCK_SECTOR_SIZE)
+            break;
+          sector = byte_to_sector (inode, offset + ofs);
+          kbuf = direct_buffer (buffer + ofs);
+          if (!is_data_sector (sector) || kbuf == NULL
+              || (cnt > 0 && sector != start + cnt))
+            break;
+          if (cnt == 0)
+            start = sector;
+          buffers[cnt++] = kbuf;
+        }
+      if (cnt == 0)
+        break;
+
+      if (write)
+        {
+          block_writev (fs_device, start, buffers, cnt);
+          block_cache_update_range (fs_device, start, buffers, cnt);
+        }
+      else
+        {
+          block_cache_write_back_range (fs_device, start, cnt);
+          block_readv (fs_device, start, buffers, cnt);
+        }
+      done += (off_t) cnt * BLOCK_SECTOR_SIZE;
+    }
+  return done;
+}
+
+/* Does inode_read_at() or, if WRITE, inode_write_at() for a
+   file opened for direct I/O.  Whole sectors move straight
+   between BUFFER and the device; the partial sectors at either
+   end, and any sector direct_transfer() can't take, go through
+   the buffer cache. */
+static off_t
+inode_direct_rw (struct inode *inode, uint8_t *buffer, off_t size,
+                 off_t offset, bool write)
+{
+  off_t done = 0;
+
+  while (size > done)
+    {
+      int sector_ofs = (offset + done) % BLOCK_SECTOR_SIZE;
+      off_t chunk = 0;
+
+      if (sector_ofs == 0)
+        chunk = direct_transfer (inode, buffer + done, size - done,
+                                 offset + done, write);
+      if (chunk == 0)
+        {
+          chunk = BLOCK_SECTOR_SIZE - sector_ofs;
+          if (chunk > size - done)
+            chunk = size - done;
+          chunk = write
+                  ? inode_write_at (inode, buffer + done, chunk, offset + done)
+                  : inode_read_at (inode, buffer + done, chunk, offset + done);
+          if (chunk == 0)
+            break;
+        }
+      done += chunk;
+    }
+  return done;
+}
+
+/* Like inode_read_at(), but moves whole sectors straight from
+   the device into BUFFER instead of through the buffer cache. */
+off_t
+inode_read_at_direct (struct inode *inode, void *buffer, off_t size,
+                      off_t offset)
+{
+  if (size <= 0 || offset < 0)
+    return 0;
+  return inode_direct_rw (inode, buffer, size, offset, false);
+}
+
+/* Like inode_write_at(), but moves whole sectors straight from
+   BUFFER to the device instead of through the buffer cache. */
+off_t
+inode_write_at_direct (struct inode *inode, const void *buffer, off_t size,
+                       off_t offset)
+{
+  if (size <= 0 || offset < 0 || inode->deny_write_cnt)
+    return 0;
+  if (inode_length (inode) < offset + size
+      && !inode_block_allocate (inode, offset, offset + size))
+    return 0;
+  return inode_direct_rw (inode, (uint8_t *) buffer, size, offset, true);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -434,41 +1336,304 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *data = inode_get_data(inode);
-  off_t answer = data->length;
-  free(data);
-  return answer;
+  return inode->data.length;
 }
 
 /* Returns whether the underlying disk of inode is a dir */
 uint32_t
 inode_is_dir (const struct inode *inode) {
-  struct inode_disk *data = inode_get_data(inode);
-  uint32_t answer = data->is_dir;
-  free(data);
-  return answer;
+  return inode->data.is_dir;
 }
 
-/*- takes in some byte number beyond end of file
-- checks to see if there is room in `free-map`
-- allocates blocks up to that point, adjusting `inode`'s pointers
+/*- takes in a range of bytes about to be written, START up to END_POS
+- for the pointer layout, allocates blocks up to END_POS if it's beyond end of file
+- for extents, maps just the blocks of the range that are holes
+- grows the length to END_POS if it's beyond end of file
+
+return true if successful else false
+
+The resident copy in INODE is updated under its inode_lock and
+written through to the inode's sector, so concurrent extenders
+don't allocate the same blocks twice.*/
 
-return true if successful else false*/
+static bool extent_grow (struct inode_disk *, block_sector_t, struct inode *,
+                         off_t, off_t);
 
 bool
-inode_block_allocate(struct inode *inode, off_t end_pos)
+inode_block_allocate(struct inode *inode, off_t start, off_t end_pos)
+{
+  bool success = true;
+
+  lock_acquire(&inode->inode_lock);
+  if (inode->data.magic == INODE_MAGIC_INLINE && end_pos > INODE_INLINE_MAX)
+    success = inline_to_extent(inode);
+  if (!success)
+    ; //still inline, unchanged
+  else if (inode->data.magic == INODE_MAGIC_INLINE) {
+    if (inode->data.length < end_pos)
+      inode->data.length = end_pos; //the bytes past the old length are already zeros
+  } else if (inode->data.magic == INODE_MAGIC_EXTENT)
+    success = extent_grow(&inode->data, inode->sector, inode, start, end_pos);
+  else if (inode->data.length < end_pos)
+    success = inode_block_alloc_helper(&inode->data, inode->sector, end_pos); //updates length and possibly doubly ind in place
+  //even a failed extent_grow may have mapped some blocks
+  block_cache_write(fs_device, inode->sector, &inode->data);
+  xlate_invalidate(inode);
+  lock_release(&inode->inode_lock);
+  return success;
+}
+
+/* Fills sector SECTOR with zeros, in the buffer cache: a newly
+   allocated sector still holds whatever a deleted file left in
+   it. */
+static void
+zero_sector (block_sector_t sector)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  block_cache_write (fs_device, sector, zeros);
+}
+
+/* Maps each unmapped block of ID from BLOCK up to END_BLOCK,
+   whose inode is in sector INODE_SECTOR, to a free sector.  Each
+   run of unmapped blocks gets as few runs of sectors as the free
+   map allows, placed right after the sector of the block before
+   it, or after the inode for the first block, so that the file
+   reads back sequentially.  If PA is non-null, takes sectors
+   from its preallocation first.  The new sectors are zeroed,
+   except those of blocks KEEP_START up to KEEP_END, which the
+   caller overwrites whole before releasing inode_lock.  Sets *GOAL to the sector
+   after the last one mapped.  Needs free_map_lock. */
+static bool
+extent_map_range (struct inode_disk *id, block_sector_t inode_sector,
+                  struct inode *pa, uint32_t block, uint32_t end_block,
+                  uint32_t keep_start, uint32_t keep_end,
+                  block_sector_t *goal)
+{
+  *goal = inode_sector + 1;
+  if (block > 0)
+    {
+      block_sector_t prev = extent_block_to_sector (id, block - 1, NULL);
+      if (is_data_sector (prev))
+        *goal = prev + 1;
+    }
+  while (block < end_block)
+    {
+      struct extent run;
+      block_sector_t sector = extent_block_to_sector (id, block, &run);
+      block_sector_t start;
+      uint32_t cnt, i;
+
+      if (is_data_sector (sector))
+        {
+          /* Skip the rest of the extent. */
+          *goal = run.start + run.cnt;
+          block = run.block + run.cnt;
+          continue;
+        }
+
+      for (cnt = 1; block + cnt < end_block; cnt++)
+        if (is_data_sector (extent_block_to_sector (id, block + cnt, NULL)))
+          break;
+      if (pa != NULL && pa->prealloc_cnt > 0)
+        {
+          start = pa->prealloc_start;
+          if (cnt > pa->prealloc_cnt)
+            cnt = pa->prealloc_cnt;
+          pa->prealloc_start += cnt;
+          pa->prealloc_cnt -= cnt;
+        }
+      else
+        {
+          cnt = free_map_allocate_near (cnt, *goal, &start);
+          if (cnt == 0)
+            return false;
+        }
+      if (!extent_add (id, block, start, cnt))
+        {
+          free_map_release (start, cnt);
+          return false;
+        }
+      for (i = 0; i < cnt; i++)
+        if (block + i < keep_start || block + i >= keep_end)
+          zero_sector (start + i);
+      *goal = start + cnt;
+      block += cnt;
+    }
+  return true;
+}
+
+/* Reserves the next preallocation window of INODE, an appending
+   file, starting at GOAL if it can, so the next appends extend
+   its last extent.  The window doubles each time, up to
+   PREALLOC_MAX, but nothing is reserved once the disk is nearly
+   full.  Needs inode_lock and free_map_lock. */
+static void
+prealloc_refill (struct inode *inode, block_sector_t goal)
 {
-  struct inode_disk *id = inode_get_data(inode);
-  bool success = inode_block_alloc_helper(id, end_pos);
-  block_cache_write(fs_device, inode->sector, id); //write new inode to disk with new length and possibly new doubly ind
-  free(id);
+  block_sector_t window = inode->prealloc_window * 2;
+
+  if (window < PREALLOC_MIN)
+    window = PREALLOC_MIN;
+  if (window > PREALLOC_MAX)
+    window = PREALLOC_MAX;
+  if (inode->prealloc_cnt > 0 || free_map_num_free () < 4 * window)
+    return;
+  inode->prealloc_cnt = free_map_allocate_near (window, goal,
+                                                &inode->prealloc_start);
+  inode->prealloc_window = window;
+}
+
+/* Makes room in INODE, an INODE_MAGIC_EXTENT inode in sector
+   SECTOR with disk inode ID, for a write of bytes START up to
+   END_LEN: maps the blocks of that range that are holes, and
+   grows the length to END_LEN if it is shorter.  Blocks between
+   the old end of file and START stay holes.  A write at or past
+   the end of file is an append, which takes sectors from
+   INODE's preallocation and then reserves more.
+
+   New sectors are zeroed, even those the write covers whole: the
+   length grows before the write copies its data in, and a
+   concurrent reader must not see what a deleted file left in
+   them.  Zeroing only goes to the buffer cache, where the write
+   then overwrites it, so it costs no disk I/O. */
+static bool
+extent_grow (struct inode_disk *id, block_sector_t sector,
+             struct inode *inode, off_t start, off_t end_len)
+{
+  uint32_t block = start / BLOCK_SECTOR_SIZE;
+  uint32_t end_block = bytes_to_sectors (end_len);
+  struct inode *pa = start >= id->length ? inode : NULL;
+  block_sector_t goal;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (extent_map_range (id, sector, pa, block, end_block, 0, 0, &goal))
+    {
+      if (id->length < end_len)
+        id->length = end_len;
+      if (pa != NULL && end_block > block)
+        prealloc_refill (pa, goal);
+      success = true;
+    }
+  free_map_flush ();
+  lock_release (&free_map_lock);
   return success;
 }
 
+/* Moves the data of INODE, an INODE_MAGIC_INLINE inode, out to
+   a block of its own and turns INODE into an INODE_MAGIC_EXTENT
+   inode, for a write that won't fit inside it.  Returns false,
+   leaving INODE unchanged, if the disk is full.  Needs
+   inode_lock. */
+static bool
+inline_to_extent (struct inode *inode)
+{
+  struct inode_disk *id = &inode->data;
+  uint8_t block[BLOCK_SECTOR_SIZE];
+  block_sector_t goal;
+  bool success = true;
+
+  memset (block, 0, sizeof block);
+  memcpy (block, id->inline_data, sizeof id->inline_data);
+  memset (id->inline_data, 0, sizeof id->inline_data);
+  id->magic = INODE_MAGIC_EXTENT;
+  if (id->length > 0)
+    {
+      /* Block 0 gets overwritten whole right away, so it need not
+         be zeroed first. */
+      lock_acquire (&free_map_lock);
+      success = extent_map_range (id, inode->sector, NULL, 0, 1, 0, 1, &goal);
+      free_map_flush ();
+      lock_release (&free_map_lock);
+      if (success)
+        block_cache_write (fs_device, extent_block_to_sector (id, 0, NULL),
+                           block);
+      else
+        {
+          memcpy (id->inline_data, block, sizeof id->inline_data);
+          id->magic = INODE_MAGIC_INLINE;
+          return false;
+        }
+    }
+  block_cache_write (fs_device, inode->sector, id);
+  xlate_invalidate (inode);
+  return true;
+}
+
+/* Returns the number of blocks of ID from BLOCK up to END_BLOCK
+   that are holes. */
+static uint32_t
+extent_hole_cnt (const struct inode_disk *id, uint32_t block,
+                 uint32_t end_block)
+{
+  uint32_t cnt = 0;
+
+  while (block < end_block)
+    {
+      struct extent run;
+      if (is_data_sector (extent_block_to_sector (id, block, &run)))
+        block = run.block + run.cnt;
+      else
+        {
+          cnt++;
+          block++;
+        }
+    }
+  return cnt;
+}
+
+/* Makes sure that bytes 0 through LENGTH - 1 of INODE have
+   sectors of their own, allocated as contiguously as the free
+   map allows, without changing INODE's length.  Later writes up
+   to LENGTH then never allocate.  Holes get zeroed sectors, so
+   they still read as zeros.  An inline inode already has room
+   for INODE_INLINE_MAX bytes, and moves its data out to a block
+   for more.  Returns false, mapping nothing, if LENGTH is
+   negative or more than the disk's free space can hold, or if
+   INODE uses the old pointer layout, which can't map blocks past
+   its length. */
 bool
-inode_block_alloc_helper(struct inode_disk *id, off_t end_len)
+inode_reserve (struct inode *inode, off_t length)
 {
+  block_sector_t goal;
+  uint32_t end_block;
+  bool success;
+
+  if (length < 0 || inode->data.magic == INODE_MAGIC)
+    return false;
+  end_block = bytes_to_sectors (length);
+  if (end_block > block_size (fs_device))
+    return false;
+
+  lock_acquire (&inode->inode_lock);
+  if (inode->data.magic == INODE_MAGIC_INLINE
+      && (length <= INODE_INLINE_MAX || !inline_to_extent (inode)))
+    {
+      lock_release (&inode->inode_lock);
+      return length <= INODE_INLINE_MAX;
+    }
+  lock_acquire (&free_map_lock);
+  /* Check first, so that a reservation too big for the disk
+     doesn't leave whatever it did map allocated past the end of
+     file. */
+  success = (extent_hole_cnt (&inode->data, 0, end_block)
+             <= free_map_num_free ())
+            && extent_map_range (&inode->data, inode->sector, NULL, 0,
+                                 end_block, 0, 0, &goal);
+  free_map_flush ();
+  lock_release (&free_map_lock);
+  block_cache_write (fs_device, inode->sector, &inode->data);
+  xlate_invalidate (inode);
+  lock_release (&inode->inode_lock);
+  return success;
+}
 
+/* Grows an INODE_MAGIC inode to END_LEN bytes, allocating every
+   block up to there: the pointer layout has no holes. */
+bool
+inode_block_alloc_helper(struct inode_disk *id, block_sector_t sector UNUSED, off_t end_len)
+{
   off_t len = id->length;
 
   off_t free_bytes = BLOCK_SECTOR_SIZE - (len % BLOCK_SECTOR_SIZE);
@@ -565,6 +1730,7 @@ inode_block_alloc_helper(struct inode_disk *id, off_t end_len)
   }
 
   id->length = end_len;
+  free_map_flush();
   lock_release(&free_map_lock);
   return true;
 }
@@ -8,6 +8,7 @@
 struct bitmap;
 
 void inode_init (void);
+void inode_done (void);
 bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -16,6 +17,12 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_at_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_at_direct (struct inode *, const void *, off_t size,
+                             off_t offset);
+void inode_read_ahead (struct inode *, off_t start, off_t length);
+void inode_prefetch (struct inode *, off_t start, off_t length);
+bool inode_reserve (struct inode *, off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
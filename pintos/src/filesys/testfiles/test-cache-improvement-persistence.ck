@@ -3,5 +3,5 @@ use strict;
 use warnings;
 use tests::tests;
 use tests::random;
-check_archive ({"please" => [random_bytes (2048)]});
+check_archive ({"myfile.txt" => [random_bytes (2048)]});
 pass;
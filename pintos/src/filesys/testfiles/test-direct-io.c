@@ -0,0 +1,102 @@
+/* Mixes direct reads and writes, sector-aligned and not, with
+   buffered I/O on the same file, through two descriptors, and
+   checks that each side sees what the other wrote.  Data is
+   written first inverted, then as is, so that every overwrite
+   changes the bytes and the file ends up holding DATA. */
+
+#include <fcntl.h>
+#include <random.h>
+#include <stdbool.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_NAME "direct"
+#define BLOCK_SECTOR_SIZE 512
+#define SIZE (10 * BLOCK_SECTOR_SIZE)
+
+/* Final contents of the file. */
+static char data[SIZE];
+
+/* Expected contents of the file so far. */
+static char model[SIZE];
+
+/* Data to write, and data read back. */
+static char wbuf[SIZE];
+static char rbuf[SIZE];
+
+/* Writes SIZE bytes of DATA at OFS, inverted if INVERT, through
+   FD, whose kind is named by WHAT, and updates the model. */
+static void
+write_at (int fd, const char *what, size_t ofs, size_t size, bool invert)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    wbuf[i] = invert ? ~data[ofs + i] : data[ofs + i];
+  seek (fd, ofs);
+  if (write (fd, wbuf, size) != (int) size)
+    fail ("%s write of %zu bytes at %zu failed", what, size, ofs);
+  memcpy (model + ofs, wbuf, size);
+  msg ("%s write of %zu bytes at %zu", what, size, ofs);
+}
+
+/* Reads SIZE bytes at OFS through FD, whose kind is named by
+   WHAT, and compares them against the model. */
+static void
+read_at (int fd, const char *what, size_t ofs, size_t size)
+{
+  memset (rbuf, 0, size);
+  seek (fd, ofs);
+  if (read (fd, rbuf, size) != (int) size)
+    fail ("%s read of %zu bytes at %zu failed", what, size, ofs);
+  compare_bytes (rbuf, model + ofs, size, ofs, FILE_NAME);
+  msg ("%s read of %zu bytes at %zu", what, size, ofs);
+}
+
+void
+test_main (void)
+{
+  int buffered, direct;
+
+  random_bytes (data, sizeof data);
+  CHECK (create (FILE_NAME, 0), "create \"%s\"", FILE_NAME);
+  CHECK ((buffered = open (FILE_NAME)) > 1, "open \"%s\"", FILE_NAME);
+  CHECK ((direct = open_flags (FILE_NAME, O_DIRECT)) > 1,
+         "open \"%s\" with O_DIRECT", FILE_NAME);
+
+  /* Aligned direct write, read back both ways. */
+  write_at (direct, "direct", 0, 4 * BLOCK_SECTOR_SIZE, true);
+  read_at (buffered, "buffered", 0, 4 * BLOCK_SECTOR_SIZE);
+  read_at (direct, "direct", 0, 4 * BLOCK_SECTOR_SIZE);
+
+  /* Unaligned direct write that crosses sector boundaries and
+     extends the file. */
+  write_at (direct, "direct", 3 * BLOCK_SECTOR_SIZE + 100,
+            3 * BLOCK_SECTOR_SIZE, false);
+  read_at (buffered, "buffered", 0, 6 * BLOCK_SECTOR_SIZE + 100);
+
+  /* Buffered writes, partly into sectors that were just written
+     directly, then direct reads of them. */
+  write_at (buffered, "buffered", 700, 1000, true);
+  write_at (buffered, "buffered", 6 * BLOCK_SECTOR_SIZE + 100,
+            4 * BLOCK_SECTOR_SIZE - 100, false);
+  read_at (direct, "direct", 0, SIZE);
+  read_at (direct, "direct", 650, 2 * BLOCK_SECTOR_SIZE + 13);
+
+  /* Direct and buffered writes over data that is in the buffer
+     cache, then buffered reads of them. */
+  write_at (direct, "direct", 0, 3 * BLOCK_SECTOR_SIZE, false);
+  write_at (buffered, "buffered", 3 * BLOCK_SECTOR_SIZE, 100, false);
+  read_at (buffered, "buffered", BLOCK_SECTOR_SIZE - 1, 3);
+  read_at (buffered, "buffered", 0, SIZE);
+  read_at (direct, "direct", 0, SIZE);
+
+  msg ("close \"%s\"", FILE_NAME);
+  close (direct);
+  msg ("close \"%s\"", FILE_NAME);
+  close (buffered);
+
+  check_file (FILE_NAME, data, sizeof data);
+}
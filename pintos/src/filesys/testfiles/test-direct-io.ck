@@ -0,0 +1,32 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(test-direct-io) begin
+(test-direct-io) create "direct"
+(test-direct-io) open "direct"
+(test-direct-io) open "direct" with O_DIRECT
+(test-direct-io) direct write of 2048 bytes at 0
+(test-direct-io) buffered read of 2048 bytes at 0
+(test-direct-io) direct read of 2048 bytes at 0
+(test-direct-io) direct write of 1536 bytes at 1636
+(test-direct-io) buffered read of 3172 bytes at 0
+(test-direct-io) buffered write of 1000 bytes at 700
+(test-direct-io) buffered write of 1948 bytes at 3172
+(test-direct-io) direct read of 5120 bytes at 0
+(test-direct-io) direct read of 1037 bytes at 650
+(test-direct-io) direct write of 1536 bytes at 0
+(test-direct-io) buffered write of 100 bytes at 1536
+(test-direct-io) buffered read of 3 bytes at 511
+(test-direct-io) buffered read of 5120 bytes at 0
+(test-direct-io) direct read of 5120 bytes at 0
+(test-direct-io) close "direct"
+(test-direct-io) close "direct"
+(test-direct-io) open "direct" for verification
+(test-direct-io) verified contents of "direct"
+(test-direct-io) close "direct"
+(test-direct-io) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Reserves disk space for a file with fallocate, which must not
+   change its size, then fills the reserved space and reads it
+   back.  Lengths no file or disk can hold must be refused. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_NAME "reserved"
+#define SIZE 20000
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (FILE_NAME, 0), "create \"%s\"", FILE_NAME);
+  CHECK ((fd = open (FILE_NAME)) > 1, "open \"%s\"", FILE_NAME);
+
+  CHECK (fallocate (fd, sizeof buf), "fallocate %zu bytes", sizeof buf);
+  CHECK (filesize (fd) == 0, "size of \"%s\" is still 0", FILE_NAME);
+  CHECK (!fallocate (fd, 0x80000000u),
+         "fallocate past the largest file size fails");
+  CHECK (!fallocate (fd, 0x7fffffffu),
+         "fallocate of more than the disk holds fails");
+  CHECK (filesize (fd) == 0, "size of \"%s\" is still 0", FILE_NAME);
+
+  msg ("writing \"%s\"", FILE_NAME);
+  if (write (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("write %zu bytes to \"%s\" failed", sizeof buf, FILE_NAME);
+  msg ("close \"%s\"", FILE_NAME);
+  close (fd);
+
+  check_file (FILE_NAME, buf, sizeof buf);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(test-fallocate) begin
+(test-fallocate) create "reserved"
+(test-fallocate) open "reserved"
+(test-fallocate) fallocate 20000 bytes
+(test-fallocate) size of "reserved" is still 0
+(test-fallocate) fallocate past the largest file size fails
+(test-fallocate) fallocate of more than the disk holds fails
+(test-fallocate) size of "reserved" is still 0
+(test-fallocate) writing "reserved"
+(test-fallocate) close "reserved"
+(test-fallocate) open "reserved" for verification
+(test-fallocate) verified contents of "reserved"
+(test-fallocate) close "reserved"
+(test-fallocate) end
+EOF
+pass;
@@ -0,0 +1,38 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+/* Number of buckets in the histograms below.  Bucket 0 counts
+   values 0 and 1, and bucket N > 0 counts values from 2**N up to
+   2**(N+1) - 1, except that the last bucket also counts anything
+   larger. */
+#define BLOCK_LATENCY_BUCKETS 24
+#define BLOCK_SEEK_BUCKETS 32
+
+/* Request statistics of one block device, as returned by the
+   block_stats() system call.  Counts are since boot.  Index 0 of
+   each pair is for reads and index 1 for writes.
+
+   A request counts against the last device it was submitted to,
+   so requests to a partition show up under its disk. */
+struct block_stats
+  {
+    char name[16];                      /* Device name, e.g. "hda". */
+    unsigned long long sectors[2];      /* Sectors transferred. */
+    unsigned long long requests[2];     /* Requests completed. */
+    unsigned long long latency_us[2];   /* Their total latency. */
+    unsigned long long latency_hist[2][BLOCK_LATENCY_BUCKETS];
+                                        /* Latency, submit to completion,
+                                           in microseconds. */
+    unsigned long long depth_sum;       /* Requests in flight, including
+                                           itself, as each was submitted. */
+    unsigned in_flight;                 /* Requests in flight now. */
+    unsigned max_in_flight;             /* Most ever in flight. */
+    unsigned long long dispatches;      /* Transfers handed to the driver. */
+    unsigned long long seeks;           /* Those not starting where the
+                                           previous one ended. */
+    unsigned long long seek_sectors;    /* Total distance of those seeks. */
+    unsigned long long seek_hist[BLOCK_SEEK_BUCKETS];
+                                        /* Seek distance in sectors. */
+  };
+
+#endif /* lib/block-stats.h */
@@ -0,0 +1,21 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, as returned by the cache_stats()
+   system call.  Counts are since boot or the last
+   cache_reset(). */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Requests found in the cache. */
+    unsigned long long misses;          /* Requests that had to take a block. */
+    unsigned long long evictions;       /* Misses that replaced another sector. */
+    unsigned long long write_backs;     /* Dirty sectors written to disk. */
+    unsigned long long read_aheads;     /* Sectors brought in by read-ahead. */
+    unsigned long long read_ahead_hits; /* Read-ahead sectors later requested. */
+    unsigned long long lock_waits;      /* Cache lock acquisitions that blocked. */
+    unsigned long long lock_wait_ticks; /* Timer ticks spent blocked on them. */
+    unsigned blocks;                    /* Sectors the cache can hold now. */
+    unsigned dirty;                     /* Dirty sectors in the cache now. */
+  };
+
+#endif /* lib/cache-stats.h */
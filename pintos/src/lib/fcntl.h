@@ -0,0 +1,9 @@
+#ifndef __LIB_FCNTL_H
+#define __LIB_FCNTL_H
+
+/* Flags for the open_flags() system call. */
+#define O_DIRECT 0x1            /* Move whole sectors between the caller's
+                                   buffer and the disk, bypassing the
+                                   buffer cache. */
+
+#endif /* lib/fcntl.h */
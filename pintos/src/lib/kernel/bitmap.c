@@ -21,6 +21,15 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Summary of the runs of 0 bits in a range of elements, for the
+   run index. */
+struct run_summary
+  {
+    uint32_t pre;       /* Length of the run at the start of the range. */
+    uint32_t suf;       /* Length of the run at the end of the range. */
+    uint32_t best;      /* Longest run anywhere in the range. */
+  };
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
    simulates an array of bits. */
@@ -28,8 +37,18 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t next;        /* Where bitmap_scan_and_flip_next() starts. */
+
+    /* Optional run index, built by bitmap_build_index(): a
+       segment tree with node 1 at the root, the children of node
+       N at 2N and 2N + 1, and element E summarized by leaf
+       LEAF_CNT + E.  Bits past BIT_CNT count as 1s. */
+    struct run_summary *index;
+    size_t leaf_cnt;    /* Number of leaves, a power of 2. */
   };
 
+static void index_update (struct bitmap *, size_t elem);
+
 /* Returns the index of the element that contains the bit
    numbered BIT_IDX. */
 static inline size_t
@@ -69,6 +88,52 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns an elem_type in which bits LO through HI - 1 are set,
+   where LO < ELEM_BITS and LO < HI <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t lo, size_t hi)
+{
+  elem_type below_hi = hi < ELEM_BITS ? ((elem_type) 1 << hi) - 1 : (elem_type) -1;
+  return below_hi & ~(((elem_type) 1 << lo) - 1);
+}
+
+/* Returns the number of bits set in X. */
+static inline size_t
+popcount (elem_type x)
+{
+  x = x - ((x >> 1) & (elem_type) 0x5555555555555555ULL);
+  x = (x & (elem_type) 0x3333333333333333ULL)
+      + ((x >> 2) & (elem_type) 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+  return (x * (elem_type) 0x0101010101010101ULL) >> (ELEM_BITS - CHAR_BIT);
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before LIMIT that is set to VALUE, or LIMIT if there is none.
+   Skips whole elements that hold no such bit, and finds the bit
+   within an element with one bsf instruction. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value, size_t limit)
+{
+  size_t i = start;
+
+  ASSERT (limit <= b->bit_cnt);
+  while (i < limit)
+    {
+      size_t idx = elem_idx (i);
+      elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+
+      e &= (elem_type) -1 << (i % ELEM_BITS);
+      if (e != 0)
+        {
+          size_t bit = idx * ELEM_BITS + __builtin_ctzl (e);
+          return bit < limit ? bit : limit;
+        }
+      i = (idx + 1) * ELEM_BITS;
+    }
+  return limit;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -82,6 +147,9 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next = 0;
+      b->index = NULL;
+      b->leaf_cnt = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -105,6 +173,9 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->next = 0;
+  b->index = NULL;
+  b->leaf_cnt = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -124,6 +195,7 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL)
     {
+      free (b->index);
       free (b->bits);
       free (b);
     }
@@ -163,6 +235,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  index_update (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -176,6 +249,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  index_update (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,6 +265,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  index_update (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +288,33 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated with one atomic instruction. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
+  size_t i, end;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  end = start + cnt;
+  for (i = start; i < end; )
+    {
+      size_t idx = elem_idx (i);
+      size_t lo = i % ELEM_BITS;
+      size_t hi = end - i < ELEM_BITS - lo ? lo + (end - i) : ELEM_BITS;
+      elem_type mask = range_mask (lo, hi);
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      index_update (b, idx);
+      i += hi - lo;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +322,23 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i, value_cnt;
+  size_t i, end, set_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  end = start + cnt;
+  set_cnt = 0;
+  for (i = start; i < end; )
+    {
+      size_t lo = i % ELEM_BITS;
+      size_t hi = end - i < ELEM_BITS - lo ? lo + (end - i) : ELEM_BITS;
+
+      set_cnt += popcount (b->bits[elem_idx (i)] & range_mask (lo, hi));
+      i += hi - lo;
+    }
+  return value ? set_cnt : cnt - set_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +346,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return next_bit (b, start, value, start + cnt) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -288,23 +379,39 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+static size_t index_scan (const struct bitmap *, size_t start, size_t cnt);
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+   Hops from run to run of VALUE bits a whole element at a time,
+   or, when looking for 0 bits in a bitmap with a run index, takes
+   O(log n) steps. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  if (cnt > b->bit_cnt || start > b->bit_cnt - cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+  if (b->index != NULL && !value)
+    return index_scan (b, start, cnt);
+
+  while (start <= b->bit_cnt - cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      size_t run_start = next_bit (b, start, value, b->bit_cnt);
+      size_t run_end;
+
+      if (run_start > b->bit_cnt - cnt)
+        break;
+      run_end = next_bit (b, run_start, !value, run_start + cnt);
+      if (run_end == run_start + cnt)
+        return run_start;
+      start = run_end;
     }
   return BITMAP_ERROR;
 }
@@ -325,6 +432,191 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
   return idx;
 }
 
+/* Like bitmap_scan_and_flip(), but starts where the last call
+   for B left off instead of at a given bit, wrapping around to
+   the beginning, so that successive calls spread out over B
+   rather than all searching its crowded start. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t idx = bitmap_scan (b, b->next, cnt, value);
+  if (idx == BITMAP_ERROR && b->next > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next = idx + cnt < b->bit_cnt ? idx + cnt : 0;
+    }
+  return idx;
+}
+
+/* Run index. */
+
+/* Returns the summary of leaf LEAF of B's run index. */
+static struct run_summary
+leaf_summary (const struct bitmap *b, size_t leaf)
+{
+  struct run_summary s;
+  elem_type e, free_bits;
+
+  if (leaf >= elem_cnt (b->bit_cnt))
+    e = (elem_type) -1;
+  else
+    {
+      e = b->bits[leaf];
+      if (leaf == elem_cnt (b->bit_cnt) - 1)
+        e |= ~last_mask (b);
+    }
+  if (e == 0)
+    {
+      s.pre = s.suf = s.best = ELEM_BITS;
+      return s;
+    }
+  s.pre = __builtin_ctzl (e);
+  s.suf = __builtin_clzl (e);
+
+  /* Each step shortens every run of 1s in FREE_BITS by one. */
+  s.best = 0;
+  for (free_bits = ~e; free_bits != 0; free_bits &= free_bits << 1)
+    s.best++;
+  return s;
+}
+
+/* Returns the summary of two adjacent ranges of HALF bits each. */
+static struct run_summary
+combine (struct run_summary l, struct run_summary r, size_t half)
+{
+  struct run_summary s;
+
+  s.pre = l.pre == half ? half + r.pre : l.pre;
+  s.suf = r.suf == half ? half + l.suf : r.suf;
+  s.best = l.suf + r.pre;
+  if (l.best > s.best)
+    s.best = l.best;
+  if (r.best > s.best)
+    s.best = r.best;
+  return s;
+}
+
+/* Brings the run index of B, if any, up to date with element
+   IDX, in O(log n) steps.  Not atomic, so bitmaps with an index
+   need their updates serialized. */
+static void
+index_update (struct bitmap *b, size_t idx)
+{
+  size_t node, half;
+
+  if (b->index == NULL)
+    return;
+  node = b->leaf_cnt + idx;
+  b->index[node] = leaf_summary (b, idx);
+  for (half = ELEM_BITS; node > 1; half *= 2)
+    {
+      node /= 2;
+      b->index[node] = combine (b->index[2 * node], b->index[2 * node + 1],
+                                half);
+    }
+}
+
+/* Rebuilds B's whole run index from its bits. */
+static void
+index_rebuild (struct bitmap *b)
+{
+  size_t node;
+
+  for (node = 0; node < b->leaf_cnt; node++)
+    b->index[b->leaf_cnt + node] = leaf_summary (b, node);
+  for (node = b->leaf_cnt - 1; node >= 1; node--)
+    {
+      /* Node N is at depth floor(log2(N)). */
+      size_t depth = ELEM_BITS - 1 - __builtin_clzl (node);
+      size_t half = ELEM_BITS * b->leaf_cnt >> (depth + 1);
+      b->index[node] = combine (b->index[2 * node], b->index[2 * node + 1],
+                                half);
+    }
+}
+
+/* Gives B an index of its runs of 0 bits, a segment tree over its
+   elements, so that bitmap_scan() finds CNT consecutive 0 bits in
+   O(log n) steps instead of by a linear search.  Every update to
+   B then also updates the index in O(log n) steps.  Returns false
+   if memory allocation fails, leaving B without an index. */
+bool
+bitmap_build_index (struct bitmap *b)
+{
+  size_t leaf_cnt = 1;
+
+  ASSERT (b != NULL);
+  if (b->index != NULL)
+    return true;
+  while (leaf_cnt < elem_cnt (b->bit_cnt))
+    leaf_cnt *= 2;
+  b->index = malloc (2 * leaf_cnt * sizeof *b->index);
+  if (b->index == NULL)
+    return false;
+  b->leaf_cnt = leaf_cnt;
+  index_rebuild (b);
+  return true;
+}
+
+/* Searches node NODE of B's run index, which covers bits LO
+   through LO + LEN - 1, for the first run of CNT 0 bits that
+   starts at or after bit START.  *CARRY is the number of 0 bits,
+   all at or after START, that end right before LO.  Returns the
+   first bit of the run, or BITMAP_ERROR with *CARRY updated to
+   the number of such 0 bits that end right before LO + LEN. */
+static size_t
+index_search (const struct bitmap *b, size_t node, size_t lo, size_t len,
+              size_t start, size_t cnt, size_t *carry)
+{
+  const struct run_summary *s = &b->index[node];
+  size_t found, bit;
+
+  if (lo + len <= start)
+    {
+      *carry = 0;
+      return BITMAP_ERROR;
+    }
+  if (lo >= start)
+    {
+      if (*carry + s->pre >= cnt)
+        return lo - *carry;
+      if (s->best < cnt)
+        {
+          /* Skip the whole subtree. */
+          *carry = s->pre == len ? *carry + len : s->suf;
+          return BITMAP_ERROR;
+        }
+    }
+
+  if (node < b->leaf_cnt)
+    {
+      found = index_search (b, 2 * node, lo, len / 2, start, cnt, carry);
+      if (found == BITMAP_ERROR)
+        found = index_search (b, 2 * node + 1, lo + len / 2, len / 2,
+                              start, cnt, carry);
+      return found;
+    }
+
+  /* A leaf that holds START or a long enough run: look at its bits
+     one by one. */
+  for (bit = lo; bit < lo + len; bit++)
+    if (bit < start || bit >= b->bit_cnt || bitmap_test (b, bit))
+      *carry = 0;
+    else if (++*carry >= cnt)
+      return bit + 1 - cnt;
+  return BITMAP_ERROR;
+}
+
+/* bitmap_scan() for 0 bits in B, which has a run index. */
+static size_t
+index_scan (const struct bitmap *b, size_t start, size_t cnt)
+{
+  size_t carry = 0;
+
+  return index_search (b, 1, 0, ELEM_BITS * b->leaf_cnt, start, cnt, &carry);
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -346,6 +638,8 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      if (b->index != NULL)
+        index_rebuild (b);
     }
   return success;
 }
@@ -358,6 +652,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes bytes OFS through OFS + SIZE - 1 of what bitmap_write()
+   would write for B to the same place in FILE, cut short at the
+   end of B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_partial (const struct bitmap *b, struct file *file,
+                      size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  ASSERT (ofs <= file_size);
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -29,7 +29,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_CACHE_STATS,            /* Reports buffer cache statistics. */
+    SYS_CACHE_RESET,            /* Empties the buffer cache and its statistics. */
+    SYS_BLOCK_STATS,            /* Reports a block device's request statistics. */
+    SYS_OPEN_FLAGS,             /* Open a file with flags such as O_DIRECT. */
+    SYS_FALLOCATE               /* Reserves disk space for a file. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -111,6 +111,18 @@ open (const char *file)
   return syscall1 (SYS_OPEN, file);
 }
 
+int
+open_flags (const char *file, int flags)
+{
+  return syscall2 (SYS_OPEN_FLAGS, file, flags);
+}
+
+bool
+fallocate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FALLOCATE, fd, length);
+}
+
 int
 filesize (int fd)
 {
@@ -188,3 +200,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+void
+cache_stats (struct cache_stats *stats)
+{
+  syscall1 (SYS_CACHE_STATS, stats);
+}
+
+void
+cache_reset (void)
+{
+  syscall0 (SYS_CACHE_RESET);
+}
+
+bool
+block_stats (int n, struct block_stats *stats)
+{
+  return syscall2 (SYS_BLOCK_STATS, n, stats);
+}
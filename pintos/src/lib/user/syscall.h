@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <fcntl.h>
+#include <block-stats.h>
+#include <cache-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -27,7 +30,9 @@ int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
+int open_flags (const char *file, int flags);
 int filesize (int fd);
+bool fallocate (int fd, unsigned length);
 int read (int fd, void *buffer, unsigned length);
 int write (int fd, const void *buffer, unsigned length);
 void seek (int fd, unsigned position);
@@ -45,5 +50,8 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+void cache_stats (struct cache_stats *);
+void cache_reset (void);
+bool block_stats (int n, struct block_stats *);
 
 #endif /* lib/user/syscall.h */
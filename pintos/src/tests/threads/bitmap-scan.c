@@ -0,0 +1,177 @@
+/* Checks bitmap_scan() against a bit-by-bit search, on bitmaps
+   whose sizes end inside, at and just past an element boundary,
+   for runs that cross elements, every start bit, and counts that
+   reach past the end of the bitmap.  Each pattern is checked on a
+   plain bitmap, on one indexed by bitmap_build_index() before it
+   was filled, so that its index is kept up to date bit by bit,
+   and on one indexed after it was filled. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Bitmap sizes to test. */
+static const size_t sizes[] = {1, 31, 32, 33, 95, 200, 300};
+
+/* Run lengths to look for. */
+static const size_t cnts[] = {0, 1, 2, 3, 5, 8, 13, 31, 32, 33, 47, 64,
+                              65, 100};
+
+/* Returns the first bit at or after START of the first run of CNT
+   bits in B that are all VALUE, found one bit at a time, or
+   BITMAP_ERROR if there is none. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt,
+                bool value)
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t run = 0;
+  size_t bit;
+
+  if (cnt > bit_cnt || start > bit_cnt - cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+  for (bit = start; bit < bit_cnt; bit++)
+    if (bitmap_test (b, bit) != value)
+      run = 0;
+    else if (++run == cnt)
+      return bit + 1 - cnt;
+  return BITMAP_ERROR;
+}
+
+/* Checks bitmap_scan() on B, a WHAT bitmap holding PATTERN, for
+   every start bit and value, each run length in CNTS, and the
+   lengths around B's size. */
+static void
+check_scans (const struct bitmap *b, const char *what, const char *pattern)
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t start, i;
+  int value;
+
+  for (value = 0; value <= 1; value++)
+    for (start = 0; start <= bit_cnt; start++)
+      for (i = 0; i < sizeof cnts / sizeof *cnts + 3; i++)
+        {
+          size_t cnt = (i < sizeof cnts / sizeof *cnts ? cnts[i]
+                        : bit_cnt + i - sizeof cnts / sizeof *cnts - 1);
+          size_t expected = reference_scan (b, start, cnt, value);
+          size_t actual = bitmap_scan (b, start, cnt, value);
+
+          if (actual != expected)
+            fail ("%s bitmap of %zu bits, %s: scan for %zu %d bits "
+                  "from %zu returned %zu instead of %zu",
+                  what, bit_cnt, pattern, cnt, value, start, actual,
+                  expected);
+        }
+}
+
+/* Sets bit IDX of both PLAIN and INDEXED to VALUE. */
+static void
+set_both (struct bitmap *plain, struct bitmap *indexed, size_t idx,
+          bool value)
+{
+  bitmap_set (plain, idx, value);
+  bitmap_set (indexed, idx, value);
+}
+
+/* Sets CNT bits starting at START, clipped to the bitmaps' size,
+   of both PLAIN and INDEXED to VALUE. */
+static void
+set_range (struct bitmap *plain, struct bitmap *indexed, size_t start,
+           size_t cnt, bool value)
+{
+  size_t bit_cnt = bitmap_size (plain);
+
+  if (start >= bit_cnt)
+    return;
+  if (cnt > bit_cnt - start)
+    cnt = bit_cnt - start;
+  bitmap_set_multiple (plain, start, cnt, value);
+  bitmap_set_multiple (indexed, start, cnt, value);
+}
+
+/* Checks the scans of PLAIN and INDEXED, which hold the same bits
+   described by PATTERN, and of a copy of them indexed from
+   scratch. */
+static void
+check_pattern (struct bitmap *plain, struct bitmap *indexed,
+               const char *pattern)
+{
+  size_t bit_cnt = bitmap_size (plain);
+  struct bitmap *rebuilt = bitmap_create (bit_cnt);
+  size_t bit;
+
+  if (rebuilt == NULL)
+    fail ("out of memory");
+  for (bit = 0; bit < bit_cnt; bit++)
+    bitmap_set (rebuilt, bit, bitmap_test (plain, bit));
+  if (!bitmap_build_index (rebuilt))
+    fail ("out of memory");
+
+  check_scans (plain, "plain", pattern);
+  check_scans (indexed, "updated indexed", pattern);
+  check_scans (rebuilt, "rebuilt indexed", pattern);
+  bitmap_destroy (rebuilt);
+}
+
+/* Runs every pattern on bitmaps of BIT_CNT bits. */
+static void
+test_size (size_t bit_cnt)
+{
+  struct bitmap *plain = bitmap_create (bit_cnt);
+  struct bitmap *indexed = bitmap_create (bit_cnt);
+  static const int densities[] = {5, 50, 95};
+  size_t bit, i;
+
+  if (plain == NULL || indexed == NULL || !bitmap_build_index (indexed))
+    fail ("out of memory");
+
+  check_pattern (plain, indexed, "all 0s");
+
+  set_range (plain, indexed, 0, bit_cnt, true);
+  check_pattern (plain, indexed, "all 1s");
+
+  /* Runs of 0s across element boundaries, in the middle of
+     elements and up to the last bit. */
+  set_range (plain, indexed, 28, 12, false);
+  set_range (plain, indexed, 60, 70, false);
+  set_range (plain, indexed, 131, 1, false);
+  set_range (plain, indexed, 133, 31, false);
+  if (bit_cnt > 10)
+    set_range (plain, indexed, bit_cnt - 10, 10, false);
+  check_pattern (plain, indexed, "runs of 0s");
+
+  /* The same, inverted one bit at a time. */
+  for (bit = 0; bit < bit_cnt; bit++)
+    {
+      bitmap_flip (plain, bit);
+      bitmap_flip (indexed, bit);
+    }
+  check_pattern (plain, indexed, "runs of 1s");
+
+  for (i = 0; i < sizeof densities / sizeof *densities; i++)
+    {
+      for (bit = 0; bit < bit_cnt; bit++)
+        set_both (plain, indexed, bit,
+                  (int) (random_ulong () % 100) < densities[i]);
+      check_pattern (plain, indexed, "random");
+    }
+
+  bitmap_destroy (plain);
+  bitmap_destroy (indexed);
+  msg ("bitmaps of %zu bits", bit_cnt);
+}
+
+void
+test_bitmap_scan (void)
+{
+  size_t i;
+
+  random_init (0);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    test_size (sizes[i]);
+  pass ();
+}
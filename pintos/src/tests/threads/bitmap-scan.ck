@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(bitmap-scan) begin
+(bitmap-scan) bitmaps of 1 bits
+(bitmap-scan) bitmaps of 31 bits
+(bitmap-scan) bitmaps of 32 bits
+(bitmap-scan) bitmaps of 33 bits
+(bitmap-scan) bitmaps of 95 bits
+(bitmap-scan) bitmaps of 200 bits
+(bitmap-scan) bitmaps of 300 bits
+(bitmap-scan) PASS
+(bitmap-scan) end
+EOF
+pass;
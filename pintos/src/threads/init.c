@@ -35,6 +35,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -53,6 +55,11 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk to create, in kB, or 0 for none.
+   -ramdisk-load: Copy the scratch device into it? */
+static size_t ramdisk_kb;
+static bool ramdisk_load_scratch;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -125,7 +132,16 @@ main (void)
   /* Initialize file system. */
 
   ide_init ();
+  virtio_blk_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb);
   locate_block_devices ();
+  if (ramdisk_load_scratch)
+    {
+      if (ramdisk_kb == 0)
+        PANIC ("-ramdisk-load requires -ramdisk");
+      ramdisk_load (block_get_role (BLOCK_SCRATCH));
+    }
   filesys_init (format_filesys);
   thread_current() -> working_dir = dir_open_root();
 #endif
@@ -250,6 +266,23 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        block_cache_set_size (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !block_cache_set_policy (value))
+            PANIC ("unknown buffer cache policy `%s'", value);
+        }
+      else if (!strcmp (name, "-wb-age"))
+        block_cache_set_write_behind (atoi (value), -1);
+      else if (!strcmp (name, "-wb-ratio"))
+        block_cache_set_write_behind (-1, atoi (value));
+      else if (!strcmp (name, "-no-dma"))
+        ide_dma_enabled = false;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        ramdisk_load_scratch = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -318,6 +351,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"bench", 2, fsutil_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -367,6 +401,7 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  bench BDEV         Time reading BDEV, bypassing the cache.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -376,6 +411,13 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Cache up to N sectors, fewer under memory pressure.\n"
+          "  -cache-policy=NAME Use buffer cache replacement policy 2q or lru.\n"
+          "  -wb-age=MS         Write back cached sectors dirty for MS ms.\n"
+          "  -wb-ratio=PCT      Write back everything once PCT%% of cache is dirty.\n"
+          "  -no-dma            Move IDE data by PIO even where DMA works.\n"
+          "  -ramdisk=KB        Create a KB kB RAM disk named `ramdisk'.\n"
+          "  -ramdisk-load      Copy the scratch device into the RAM disk.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
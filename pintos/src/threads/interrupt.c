@@ -46,6 +46,7 @@ static unsigned int unexpected_cnt[INTR_CNT];
    interrupt returns. */
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
+static uint64_t handler_tsc;    /* TSC cycles spent in external handlers. */
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -337,6 +338,17 @@ make_idtr_operand (uint16_t limit, void *base)
 
 /* Interrupt handlers. */
 
+/* Returns the number of timer ticks, rounded down, spent in
+   external interrupt handlers since boot. */
+int64_t
+intr_handler_ticks (void)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t tsc = handler_tsc;
+  intr_set_level (old_level);
+  return timer_tsc_to_us (tsc) * TIMER_FREQ / (1000 * 1000);
+}
+
 /* Handler for all interrupts, faults, and exceptions.  This
    function is called by the assembly language interrupt stubs in
    intr-stubs.S.  FRAME describes the interrupt and the
@@ -346,6 +358,7 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  uint64_t start = 0;
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
@@ -359,6 +372,7 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+      start = timer_tsc ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -380,6 +394,12 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
+      /* The timer tick is charged to whichever thread the
+         handler interrupted, even if that is the idle thread, so
+         keep separate count of the time spent here.  rdtsc is
+         cheap enough to do on every interrupt. */
+      handler_tsc += timer_tsc () - start;
+
       in_external_intr = false;
       pic_end_of_interrupt (frame->vec_no);
 
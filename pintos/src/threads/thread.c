@@ -149,6 +149,19 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Copies the tick counters that thread_print_stats() prints into
+   *T. */
+void
+thread_get_ticks (struct thread_ticks *t)
+{
+  enum intr_level old_level = intr_disable ();
+  t->idle = idle_ticks;
+  t->kernel = kernel_ticks;
+  t->user = user_ticks;
+  intr_set_level (old_level);
+  t->intr = intr_handler_ticks ();
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -145,6 +145,17 @@ void thread_start (void);
 void thread_tick (void);
 void thread_print_stats (void);
 
+/* Timer ticks since boot, by what the CPU was doing. */
+struct thread_ticks
+  {
+    int64_t idle;               /* In the idle thread. */
+    int64_t kernel;             /* In kernel threads. */
+    int64_t user;               /* In user programs. */
+    int64_t intr;               /* In interrupt handlers, whichever
+                                   of the above they interrupted. */
+  };
+void thread_get_ticks (struct thread_ticks *);
+
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
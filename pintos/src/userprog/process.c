@@ -12,6 +12,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -543,6 +544,10 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+  /* The whole segment is about to be read, so fetch it into the
+     buffer cache with as few disk requests as possible. */
+  inode_prefetch (file_get_inode (file), ofs, read_bytes);
+
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0)
     {
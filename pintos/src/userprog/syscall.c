@@ -1,6 +1,7 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <syscall-nr.h>
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "threads/vaddr.h"
 #include "threads/interrupt.h"
@@ -14,6 +15,7 @@
 #include "filesys/filesys.h"
 #include "pagedir.h"
 #include "filesys/off_t.h"
+#include <fcntl.h>
 //  I added
 #include "filesys/directory.h"
 #include "filesys/inode.h"
@@ -35,10 +37,11 @@ static void user_exit(int exit_code, struct intr_frame *f);
 void seek (int fd, unsigned position);
 int write(int fd, void *buffer, unsigned length, struct intr_frame *f);
 bool create (const char *file, unsigned initial_size);
-int open_helper (const char *file);
+int open_helper (const char *file, int flags);
 unsigned tell (int fd);
 int read (int fd, void *buffer, unsigned length);
 int filesize (int fd);
+bool fallocate (int fd, unsigned length);
 void close (int fd);
 bool chdir(const char* dir);
 bool mkdir(const char *dir);
@@ -115,7 +118,7 @@ static void user_exit(int exit_code, struct intr_frame *f) {
 
 
 int
-open_helper(const char *file) {
+open_helper(const char *file, int flags) {
 	if (strlen(file) == 0 ) {return -1;}
 	if (strcmp(file, "/") == 0){ // edge case
 		struct file_descriptor *file_desc = malloc(sizeof(struct file_descriptor));
@@ -157,6 +160,9 @@ open_helper(const char *file) {
   } else { // if last is not directory
     struct file *f = file_open(childnode); // this does not call inode open
     if (f == NULL) { return -1; }
+    if (flags & O_DIRECT) {
+      file_set_direct(f, true);
+    }
     file_desc->file = f;
     file_desc->inode = file_get_inode(f);
     file_desc->isdir = false;
@@ -243,6 +249,17 @@ filesize(int fd) {
   return -1;
 }
 
+bool
+fallocate(int fd, unsigned length) {
+  if (fd > STDOUT_FILENO) {
+    struct file *fp = get_file_for_fd(fd, &thread_current()->fds);
+    if (fp == NULL) return false;
+    if ((off_t) length < 0) return false; //longer than any file can be
+    return file_reserve(fp, (off_t) length);
+  }
+  return false;
+}
+
 
 // Needed for persistence
 void
@@ -375,6 +392,32 @@ syscall_handler(struct intr_frame *f) {
     lock_release(&filesys_lock);
     return;
   }
+  if (reserved_space[0] == SYS_CACHE_STATS) {
+    check_args(f, 1, reserved_space);
+    struct cache_stats *stats = (struct cache_stats *) reserved_space[1];
+
+    if (!is_valid_pointer(stats) || !is_valid_pointer((uint8_t *) stats + sizeof *stats - 1)) {
+      user_exit(-1, f);
+    }
+    block_cache_get_stats(stats);
+    return;
+  }
+  if (reserved_space[0] == SYS_BLOCK_STATS) {
+    check_args(f, 2, reserved_space);
+    struct block_stats *stats = (struct block_stats *) reserved_space[2];
+
+    if (!is_valid_pointer(stats) || !is_valid_pointer((uint8_t *) stats + sizeof *stats - 1)) {
+      user_exit(-1, f);
+    }
+    f->eax = block_get_stats((int) reserved_space[1], stats);
+    return;
+  }
+  if (reserved_space[0] == SYS_CACHE_RESET) {
+    lock_acquire(&filesys_lock);
+    block_cache_reset();
+    lock_release(&filesys_lock);
+    return;
+  }
   if (reserved_space[0] == SYS_REMOVE) {  ///TODO!
     check_args(f, 1, reserved_space);
     char *_file = (char *) reserved_space[1];
@@ -391,12 +434,22 @@ syscall_handler(struct intr_frame *f) {
     char *file = check_string(_file, f);
 
     lock_acquire(&filesys_lock);
-    int fd = open_helper((char *) _file);
+    int fd = open_helper((char *) _file, 0);
     f->eax = fd;
     lock_release(&filesys_lock);
     //free(file);
     return;
   }
+  if (reserved_space[0] == SYS_OPEN_FLAGS) {
+    check_args(f, 2, reserved_space);
+    char *file = check_string((char *) reserved_space[1], f);
+
+    lock_acquire(&filesys_lock);
+    f->eax = open_helper(file, (int) reserved_space[2]);
+    lock_release(&filesys_lock);
+    free(file);
+    return;
+  }
   if (reserved_space[0] == SYS_FILESIZE) {
     check_args(f, 1, reserved_space);
 
@@ -405,6 +458,14 @@ syscall_handler(struct intr_frame *f) {
     lock_release(&filesys_lock);
     return;
   }
+  if (reserved_space[0] == SYS_FALLOCATE) {
+    check_args(f, 2, reserved_space);
+
+    lock_acquire(&filesys_lock);
+    f->eax = fallocate ((int) reserved_space[1], (unsigned) reserved_space[2]);
+    lock_release(&filesys_lock);
+    return;
+  }
   if (reserved_space[0] == SYS_READ) {
     check_args(f, 3, reserved_space);
     void* buffer = (void*) reserved_space[2];
@@ -7,7 +7,7 @@
 
 void syscall_init (void);
 
-int open_helper (const char *file);
+int open_helper (const char *file, int flags);
 
 
 static struct file_descriptor*